@@ -0,0 +1,516 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil;  c-file-style: "k&r"; c-basic-offset: 2; -*-
+
+   Host (Linux) stand-ins for the parts of the Arduino core and the
+   Ethernet library that WebServer.h uses.  This lets the web server be
+   compiled and driven on a PC by the benchmark in bench/webbench.cpp.
+
+   The classes follow the Arduino 0022 interfaces: Print writes one
+   byte at a time unless told otherwise, Client::write is one "send"
+   on the Wiznet chip (and so one packet on the wire), and sockets are
+   a fixed table of MAX_SOCK_NUM entries just like the W5100.
+
+   Instead of a network, each socket has an in-memory receive queue
+   filled by HostNet::connect() and an in-memory transmit log that the
+   driver can inspect afterwards.
+*/
+
+#ifndef WEBDUINO_HOST_ETHERNET_H_
+#define WEBDUINO_HOST_ETHERNET_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+
+/********************************************************************
+ * PROGMEM
+ ********************************************************************/
+
+// program memory is ordinary memory on the host
+#define PROGMEM
+typedef unsigned char prog_uchar;
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+// pointers are wider than a word on the host
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define memcpy_P(dest, src, n) memcpy((dest), (src), (n))
+#define strlen_P(str) strlen((const char *)(str))
+
+/********************************************************************
+ * TIMING
+ ********************************************************************/
+
+static inline unsigned long long hostNanos()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// HostClock::offsetMicros lets a driver jump the clock forward, e.g. to
+// exercise timeouts or millis() wrap-around without waiting.
+struct HostClock
+{
+  static unsigned long long start;
+  static unsigned long long offsetMicros;
+};
+unsigned long long HostClock::start = hostNanos();
+unsigned long long HostClock::offsetMicros = 0;
+
+extern "C" unsigned long micros(void)
+{
+  return (unsigned long)((hostNanos() - HostClock::start) / 1000ULL
+                         + HostClock::offsetMicros);
+}
+
+extern "C" unsigned long millis(void)
+{
+  return (unsigned long)(((hostNanos() - HostClock::start) / 1000ULL
+                          + HostClock::offsetMicros) / 1000ULL);
+}
+
+/********************************************************************
+ * PRINT
+ ********************************************************************/
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#define BYTE 0
+
+class Print
+{
+private:
+  void printNumber(unsigned long n, uint8_t base)
+  {
+    unsigned char buf[8 * sizeof(long)];
+    unsigned long i = 0;
+
+    if (n == 0)
+    {
+      print('0');
+      return;
+    }
+
+    while (n > 0)
+    {
+      buf[i++] = n % base;
+      n /= base;
+    }
+
+    // one write per digit, as the Arduino core does
+    for (; i > 0; i--)
+      print((char)(buf[i - 1] < 10 ?
+                   '0' + buf[i - 1] :
+                   'A' + buf[i - 1] - 10));
+  }
+
+  void printFloat(double number, uint8_t digits)
+  {
+    if (number < 0.0)
+    {
+      print('-');
+      number = -number;
+    }
+
+    double rounding = 0.5;
+    for (uint8_t i = 0; i < digits; ++i)
+      rounding /= 10.0;
+    number += rounding;
+
+    unsigned long int_part = (unsigned long)number;
+    double remainder = number - (double)int_part;
+    print(int_part);
+
+    if (digits > 0)
+      print(".");
+
+    while (digits-- > 0)
+    {
+      remainder *= 10.0;
+      int toPrint = int(remainder);
+      print(toPrint);
+      remainder -= toPrint;
+    }
+  }
+
+public:
+  virtual ~Print() {}
+
+  virtual void write(uint8_t) = 0;
+
+  virtual void write(const char *str)
+  {
+    while (*str)
+      write((uint8_t)*str++);
+  }
+
+  virtual void write(const uint8_t *buffer, size_t size)
+  {
+    while (size--)
+      write(*buffer++);
+  }
+
+  void print(const char str[]) { write(str); }
+  void print(char c, int base = BYTE)
+  {
+    if (base == 0)
+      write((uint8_t)c);
+    else
+      print((long)c, base);
+  }
+  void print(unsigned char b, int base = BYTE)
+  {
+    if (base == 0)
+      write(b);
+    else
+      print((unsigned long)b, base);
+  }
+  void print(int n, int base = DEC) { print((long)n, base); }
+  void print(unsigned int n, int base = DEC) { print((unsigned long)n, base); }
+  void print(long n, int base = DEC)
+  {
+    if (base == 0)
+      write((uint8_t)n);
+    else if (base == 10)
+    {
+      if (n < 0)
+      {
+        print('-');
+        n = -n;
+      }
+      printNumber(n, 10);
+    }
+    else
+      printNumber(n, base);
+  }
+  void print(unsigned long n, int base = DEC)
+  {
+    if (base == 0)
+      write((uint8_t)n);
+    else
+      printNumber(n, base);
+  }
+  void print(double n, int digits = 2) { printFloat(n, digits); }
+
+  void println() { print('\r'); print('\n'); }
+  void println(const char c[]) { print(c); println(); }
+  void println(char c, int base = BYTE) { print(c, base); println(); }
+  void println(unsigned char b, int base = BYTE) { print(b, base); println(); }
+  void println(int n, int base = DEC) { print(n, base); println(); }
+  void println(unsigned int n, int base = DEC) { print(n, base); println(); }
+  void println(long n, int base = DEC) { print(n, base); println(); }
+  void println(unsigned long n, int base = DEC) { print(n, base); println(); }
+  void println(double n, int digits = 2) { print(n, digits); println(); }
+};
+
+/********************************************************************
+ * SOCKETS
+ ********************************************************************/
+
+#define MAX_SOCK_NUM 4
+
+// Wiznet socket status register values used by the Ethernet library
+namespace SnSR
+{
+  enum
+  {
+    CLOSED      = 0x00,
+    LISTEN      = 0x14,
+    ESTABLISHED = 0x17,
+    CLOSE_WAIT  = 0x1C
+  };
+}
+
+struct HostSocket
+{
+  uint8_t status;
+
+  // bytes the peer has sent; rxReleased of them have "arrived" so far
+  std::string rx;
+  size_t rxPos;
+  size_t rxReleased;
+
+  // close our side once all of rx has been read (client half-close)
+  bool peerCloses;
+
+  // times the server found nothing to read since the driver last
+  // cleared it, see HostNet::stallRelease
+  unsigned emptyChecks;
+
+  // room in the chip's transmit buffer.  Sends go straight into tx,
+  // so this stays at 2048 unless a driver lowers it to play a browser
+  // that has stopped taking data.
+  uint16_t txFree;
+
+  // everything the server sent, and the number of sends it took
+  std::string tx;
+  unsigned long writeCalls;
+  bool stopped;
+};
+
+struct HostNet
+{
+  static HostSocket sockets[MAX_SOCK_NUM];
+
+  // totals across all sockets since the last resetStats()
+  static unsigned long long bytesWritten;
+  static unsigned long long writeCalls;
+  static unsigned long long readCalls;
+  static unsigned long long bytesRead;
+
+  // When a driver trickles a request in with feed(), a command that
+  // waits for the rest of it (reading a POST body, say) would otherwise
+  // wait forever, as the driver only feeds between calls to the server.
+  // If this is set, a socket the server finds empty twice without the
+  // driver clearing emptyChecks gets this many more bytes, as they
+  // would arrive on a real network while the server waited.
+  static size_t stallRelease;
+
+  static void resetStats()
+  {
+    bytesWritten = writeCalls = readCalls = bytesRead = 0;
+  }
+
+  // Simulate a browser connecting to port and sending data.  The first
+  // "release" bytes arrive straight away (all of it when release is
+  // 0); feed() delivers more later.  Returns the socket number, or -1
+  // when no socket is listening (the chip is out of sockets).
+  static int connect(uint16_t port, const char *data, size_t len,
+                     size_t release = 0, bool peerCloses = false);
+
+  // make more of a socket's pending request bytes visible to the server
+  static void feed(int sock, size_t count)
+  {
+    HostSocket &s = sockets[sock];
+    s.rxReleased += count;
+    if (s.rxReleased > s.rx.size())
+      s.rxReleased = s.rx.size();
+  }
+
+  // append more request bytes on an open connection (keep-alive)
+  static void send(int sock, const char *data, size_t len)
+  {
+    HostSocket &s = sockets[sock];
+    s.rx.append(data, len);
+    s.rxReleased = s.rx.size();
+  }
+
+  // peer closes its end; the server sees it once the data is read
+  static void hangup(int sock)
+  {
+    sockets[sock].peerCloses = true;
+  }
+
+  static void clearTx(int sock)
+  {
+    sockets[sock].tx.clear();
+    sockets[sock].writeCalls = 0;
+  }
+};
+
+HostSocket HostNet::sockets[MAX_SOCK_NUM];
+unsigned long long HostNet::bytesWritten = 0;
+unsigned long long HostNet::writeCalls = 0;
+unsigned long long HostNet::readCalls = 0;
+unsigned long long HostNet::bytesRead = 0;
+size_t HostNet::stallRelease = 0;
+
+class EthernetClass
+{
+public:
+  static uint16_t _server_port[MAX_SOCK_NUM];
+
+  void begin(uint8_t *mac, uint8_t *ip) {}
+};
+
+uint16_t EthernetClass::_server_port[MAX_SOCK_NUM];
+EthernetClass Ethernet;
+
+int HostNet::connect(uint16_t port, const char *data, size_t len,
+                     size_t release, bool peerCloses)
+{
+  for (int i = 0; i < MAX_SOCK_NUM; ++i)
+  {
+    HostSocket &s = sockets[i];
+    if (s.status == SnSR::LISTEN && EthernetClass::_server_port[i] == port)
+    {
+      s.status = SnSR::ESTABLISHED;
+      s.rx.assign(data, len);
+      s.rxPos = 0;
+      s.rxReleased = (release == 0 || release > len) ? len : release;
+      s.peerCloses = peerCloses;
+      s.emptyChecks = 0;
+      s.txFree = 2048;
+      s.tx.clear();
+      s.writeCalls = 0;
+      s.stopped = false;
+      return i;
+    }
+  }
+  return -1;
+}
+
+class Client: public Print
+{
+public:
+  Client(uint8_t sock) : _sock(sock) {}
+
+  uint8_t status()
+  {
+    if (_sock >= MAX_SOCK_NUM)
+      return SnSR::CLOSED;
+    HostSocket &s = HostNet::sockets[_sock];
+    if (s.status == SnSR::ESTABLISHED && s.peerCloses &&
+        s.rxPos == s.rx.size())
+      s.status = SnSR::CLOSE_WAIT;
+    return s.status;
+  }
+
+  virtual void write(uint8_t b)
+  {
+    write(&b, 1);
+  }
+
+  virtual void write(const char *str)
+  {
+    write((const uint8_t *)str, strlen(str));
+  }
+
+  // each call is one send() on the chip, and so at least one packet
+  virtual void write(const uint8_t *buf, size_t size)
+  {
+    if (_sock >= MAX_SOCK_NUM || size == 0)
+      return;
+    HostSocket &s = HostNet::sockets[_sock];
+    s.tx.append((const char *)buf, size);
+    ++s.writeCalls;
+    HostNet::bytesWritten += size;
+    ++HostNet::writeCalls;
+  }
+
+  int available()
+  {
+    if (_sock >= MAX_SOCK_NUM)
+      return 0;
+    HostSocket &s = HostNet::sockets[_sock];
+    if (s.rxReleased == s.rxPos && HostNet::stallRelease &&
+        ++s.emptyChecks >= 2)
+    {
+      HostNet::feed(_sock, HostNet::stallRelease);
+      s.emptyChecks = 0;
+    }
+    return (int)(s.rxReleased - s.rxPos);
+  }
+
+  int read()
+  {
+    ++HostNet::readCalls;
+    if (available() == 0)
+      return -1;
+    ++HostNet::bytesRead;
+    return (uint8_t)HostNet::sockets[_sock].rx[HostNet::sockets[_sock].rxPos++];
+  }
+
+  int peek()
+  {
+    if (available() == 0)
+      return -1;
+    return (uint8_t)HostNet::sockets[_sock].rx[HostNet::sockets[_sock].rxPos];
+  }
+
+  void flush()
+  {
+    while (available())
+      read();
+  }
+
+  void stop()
+  {
+    if (_sock >= MAX_SOCK_NUM)
+      return;
+    HostSocket &s = HostNet::sockets[_sock];
+    s.status = SnSR::CLOSED;
+    s.stopped = true;
+    EthernetClass::_server_port[_sock] = 0;
+    _sock = MAX_SOCK_NUM;
+  }
+
+  uint8_t connected()
+  {
+    if (_sock >= MAX_SOCK_NUM)
+      return 0;
+    uint8_t s = status();
+    return !(s == SnSR::LISTEN || s == SnSR::CLOSED ||
+             (s == SnSR::CLOSE_WAIT && !available()));
+  }
+
+  // the 0022 library really does compare against "no socket" here
+  uint8_t operator==(int) { return _sock == MAX_SOCK_NUM; }
+  uint8_t operator!=(int) { return _sock != MAX_SOCK_NUM; }
+  operator bool() { return _sock != MAX_SOCK_NUM; }
+
+private:
+  uint8_t _sock;
+};
+
+class Server: public Print
+{
+public:
+  Server(uint16_t port) : _port(port) {}
+
+  void begin()
+  {
+    for (int sock = 0; sock < MAX_SOCK_NUM; sock++)
+    {
+      if (HostNet::sockets[sock].status == SnSR::CLOSED)
+      {
+        HostNet::sockets[sock].status = SnSR::LISTEN;
+        EthernetClass::_server_port[sock] = _port;
+        break;
+      }
+    }
+  }
+
+  Client available()
+  {
+    accept();
+
+    for (int sock = 0; sock < MAX_SOCK_NUM; sock++)
+    {
+      Client client(sock);
+      if (EthernetClass::_server_port[sock] == _port &&
+          (client.status() == SnSR::ESTABLISHED ||
+           client.status() == SnSR::CLOSE_WAIT))
+      {
+        if (client.available())
+          return client;
+      }
+    }
+
+    return Client(MAX_SOCK_NUM);
+  }
+
+  virtual void write(uint8_t b) {}
+
+private:
+  // keep one socket listening, as the Ethernet library does
+  void accept()
+  {
+    for (int sock = 0; sock < MAX_SOCK_NUM; sock++)
+    {
+      if (EthernetClass::_server_port[sock] == _port &&
+          HostNet::sockets[sock].status == SnSR::LISTEN)
+        return;
+    }
+    begin();
+  }
+
+  uint16_t _port;
+};
+
+#endif // WEBDUINO_HOST_ETHERNET_H_
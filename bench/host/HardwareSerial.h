@@ -0,0 +1,21 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil;  c-file-style: "k&r"; c-basic-offset: 2; -*-
+
+   Host stand-in for the Arduino serial port, so sketches built with
+   WEBDUINO_SERIAL_DEBUGGING can run on a PC.  Output goes to stderr.
+*/
+
+#ifndef WEBDUINO_HOST_HARDWARESERIAL_H_
+#define WEBDUINO_HOST_HARDWARESERIAL_H_
+
+#include "Ethernet.h"
+
+class HardwareSerial: public Print
+{
+public:
+  void begin(long speed) {}
+  virtual void write(uint8_t ch) { fputc(ch, stderr); }
+};
+
+HardwareSerial Serial;
+
+#endif // WEBDUINO_HOST_HARDWARESERIAL_H_
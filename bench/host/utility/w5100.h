@@ -0,0 +1,25 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil;  c-file-style: "k&r"; c-basic-offset: 2; -*-
+
+   Host stand-in for the Ethernet library's W5100 register access, for
+   the few calls WebServer.h makes on the chip directly.
+*/
+
+#ifndef WEBDUINO_HOST_W5100_H_
+#define WEBDUINO_HOST_W5100_H_
+
+#include "Ethernet.h"
+
+typedef uint8_t SOCKET;
+
+class W5100Class
+{
+public:
+  uint16_t getTXFreeSize(SOCKET s)
+  {
+    return HostNet::sockets[s].txFree;
+  }
+};
+
+W5100Class W5100;
+
+#endif // WEBDUINO_HOST_W5100_H_
@@ -0,0 +1,841 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil;  c-file-style: "k&r"; c-basic-offset: 2; -*-
+
+   webbench.cpp - host-side throughput benchmark for Webduino
+
+   Replays a corpus of canned HTTP requests through
+   WebServer::processConnection() using the in-memory Server/Client
+   stand-ins in bench/host, and reports for each request:
+
+     - requests per second
+     - mean and worst time spent in each phase of a request
+       (getRequest, processHeaders, dispatch, the handler, closing)
+     - bytes written per request
+     - Client::write calls per request, which stands in for the
+       number of packets the Wiznet chip would put on the wire
+
+   Build and run from the top of the tree with
+
+     g++ -O2 -std=gnu++98 -Ibench/host -Iwebduino \
+         -o webbench bench/webbench.cpp
+     ./webbench [-k] [-p chunk] [-r] [iterations] [request-name]
+
+   With -k, persistent connections are turned on and each request is
+   sent on the connection left open by the one before.
+
+   With -p, the server is driven through poll() instead, with several
+   browsers at once each sending their request "chunk" bytes at a
+   time between calls, and the worst time spent in one poll() call
+   (how long loop() would be held up) is reported too.
+
+   With -r, the pages are found through a route table in program
+   memory, padded out to the size of a larger sketch, instead of
+   addCommand.
+
+   Add -DWEBDUINO_METRICS=8 -DWEBDUINO_STATUS_URL='"/status"' to the
+   g++ line to see what the per-command counters cost, and to have the
+   status page served too, and -DWEBDUINO_TRACE=64 to see what the
+   trace events cost.
+
+   The "json" and "writer" requests send the same readings, written
+   with print() and with WebServer::JsonWriter, to compare the two.
+
+   The handlers below mirror the example sketches so the numbers
+   reflect the kind of pages people really serve.
+*/
+
+#include "Ethernet.h"
+
+static void benchPhase(int phase);
+#define WEBDUINO_PHASE_HOOK(phase) benchPhase(phase)
+// one more than the default, for jsonWriterCmd
+#define WEBDUINO_COMMANDS_COUNT 9
+// the features the handlers below use
+#define WEBDUINO_FEATURES \
+  (WEBDUINO_FEATURE_ROUTES | WEBDUINO_FEATURE_ASSETS | WEBDUINO_FEATURE_CACHE)
+
+#include "WebServer.h"
+
+// bench/www packed by tools/pack_assets.py --plain --name wwwAssets
+#include "www_assets.h"
+
+/********************************************************************
+ * PHASE TIMING
+ ********************************************************************/
+
+enum
+{
+  STEP_REQUEST,     // getRequest
+  STEP_HEADERS,     // processHeaders
+  STEP_DISPATCH,    // route lookup
+  STEP_HANDLER,     // application command
+  STEP_STOP,        // closing the socket
+  STEP_COUNT
+};
+
+static const char *stepNames[STEP_COUNT] =
+  { "request", "headers", "dispatch", "handler", "stop" };
+
+// maps a phase to the step that ends there
+static const int phaseEndsStep[] =
+  { -1, STEP_REQUEST, STEP_HEADERS, STEP_DISPATCH, STEP_HANDLER, STEP_STOP };
+
+struct StepStats
+{
+  unsigned long long total;
+  unsigned long long worst;
+  unsigned long count;
+};
+
+static StepStats stepStats[STEP_COUNT];
+static unsigned long long lastPhaseTime;
+
+static void benchPhase(int phase)
+{
+  unsigned long long now = hostNanos();
+  int step = phaseEndsStep[phase];
+  if (step >= 0)
+  {
+    unsigned long long elapsed = now - lastPhaseTime;
+    stepStats[step].total += elapsed;
+    if (elapsed > stepStats[step].worst)
+      stepStats[step].worst = elapsed;
+    ++stepStats[step].count;
+  }
+  // don't charge the hook itself to the next step
+  lastPhaseTime = hostNanos();
+}
+
+/********************************************************************
+ * HANDLERS
+ ********************************************************************/
+
+// stand-ins for the board's I/O so the handlers do the same work
+static int analogRead(int pin) { return 512 + pin * 37; }
+static int digitalRead(int pin) { return pin & 1; }
+
+template<class T>
+inline Print &operator <<(Print &obj, T arg)
+{ obj.print(arg); return obj; }
+
+// Web_HelloWorld / Web_Buzzer style static page
+static void defaultCmd(WebServer &server, WebServer::ConnectionType type,
+                       char *url_tail, bool tail_complete)
+{
+  server.httpSuccess();
+  if (type == WebServer::GET)
+  {
+    P(message) =
+      "<html><head><title>Webduino Buzzer Example</title>"
+      "<body>"
+      "<h1>Test the Buzzer!</h1>"
+      "<form action='/buzz' method='POST'>"
+      "<p><button name='buzz' value='0'>Turn if Off!</button></p>"
+      "<p><button name='buzz' value='500'>500</button></p>"
+      "<p><button name='buzz' value='1975'>1975</button></p>"
+      "<p><button name='buzz' value='3000'>3000</button></p>"
+      "<p><button name='buzz' value='8000'>8000</button></p>"
+      "</form></body></html>";
+    server.printP(message);
+  }
+}
+
+// Web_Image
+P(ledData) = {
+  0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+  0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x08, 0x02, 0x00, 0x00, 0x00, 0x90, 0x91, 0x68,
+  0x36, 0x00, 0x00, 0x00, 0x01, 0x73, 0x52, 0x47, 0x42, 0x00, 0xae, 0xce, 0x1c, 0xe9, 0x00, 0x00,
+  0x00, 0x04, 0x67, 0x41, 0x4d, 0x41, 0x00, 0x00, 0xb1, 0x8f, 0x0b, 0xfc, 0x61, 0x05, 0x00, 0x00,
+  0x00, 0x20, 0x63, 0x48, 0x52, 0x4d, 0x00, 0x00, 0x7a, 0x26, 0x00, 0x00, 0x80, 0x84, 0x00, 0x00,
+  0xfa, 0x00, 0x00, 0x00, 0x80, 0xe8, 0x00, 0x00, 0x75, 0x30, 0x00, 0x00, 0xea, 0x60, 0x00, 0x00,
+  0x3a, 0x98, 0x00, 0x00, 0x17, 0x70, 0x9c, 0xba, 0x51, 0x3c, 0x00, 0x00, 0x00, 0x18, 0x74, 0x45,
+  0x58, 0x74, 0x53, 0x6f, 0x66, 0x74, 0x77, 0x61, 0x72, 0x65, 0x00, 0x50, 0x61, 0x69, 0x6e, 0x74,
+  0x2e, 0x4e, 0x45, 0x54, 0x20, 0x76, 0x33, 0x2e, 0x33, 0x36, 0xa9, 0xe7, 0xe2, 0x25, 0x00, 0x00,
+  0x00, 0x57, 0x49, 0x44, 0x41, 0x54, 0x38, 0x4f, 0x95, 0x52, 0x5b, 0x0a, 0x00, 0x30, 0x08, 0x6a,
+  0xf7, 0x3f, 0xf4, 0x1e, 0x14, 0x4d, 0x6a, 0x30, 0x8d, 0x7d, 0x0d, 0x45, 0x2d, 0x87, 0xd9, 0x34,
+  0x71, 0x36, 0x41, 0x7a, 0x81, 0x76, 0x95, 0xc2, 0xec, 0x3f, 0xc7, 0x8e, 0x83, 0x72, 0x90, 0x43,
+  0x11, 0x10, 0xc4, 0x12, 0x50, 0xb6, 0xc7, 0xab, 0x96, 0xd0, 0xdb, 0x5b, 0x41, 0x5c, 0x6a, 0x0b,
+  0xfd, 0x57, 0x28, 0x5b, 0xc2, 0xfd, 0xb2, 0xa1, 0x33, 0x28, 0x45, 0xd0, 0xee, 0x20, 0x5c, 0x9a,
+  0xaf, 0x93, 0xd6, 0xbc, 0xdb, 0x25, 0x56, 0x61, 0x01, 0x17, 0x12, 0xae, 0x53, 0x3e, 0x66, 0x32,
+  0xba, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82
+};
+
+static void imageCmd(WebServer &server, WebServer::ConnectionType type,
+                     char *url_tail, bool tail_complete)
+{
+  server.httpSuccess("image/png", NULL, sizeof(ledData));
+  if (type == WebServer::GET)
+    server.writeP(ledData, sizeof(ledData));
+}
+
+// Web_Demo jsonCmd
+static void jsonCmd(WebServer &server, WebServer::ConnectionType type,
+                    char *url_tail, bool tail_complete)
+{
+  server.httpSuccess("application/json", NULL, WebServer::CHUNKED);
+  if (type == WebServer::HEAD)
+    return;
+
+  int i;
+  server << "{ ";
+  for (i = 0; i <= 9; ++i)
+  {
+    int val = digitalRead(i);
+    server << "\"d" << i << "\": " << val << ", ";
+  }
+  for (i = 0; i <= 5; ++i)
+  {
+    int val = analogRead(i);
+    server << "\"a" << i << "\": " << val;
+    if (i != 5)
+      server << ", ";
+  }
+  server << " }";
+}
+
+// jsonCmd's readings, with a JsonWriter
+static void jsonWriterCmd(WebServer &server, WebServer::ConnectionType type,
+                          char *url_tail, bool tail_complete)
+{
+  server.httpSuccess("application/json", NULL, WebServer::CHUNKED);
+  if (type == WebServer::HEAD)
+    return;
+
+  WebServer::JsonWriter json(server);
+  char name[3] = "d0";
+  int i;
+  json.beginObject();
+  for (i = 0; i <= 9; ++i)
+  {
+    name[1] = '0' + i;
+    json.key(name);
+    json.value(digitalRead(i));
+  }
+  name[0] = 'a';
+  for (i = 0; i <= 5; ++i)
+  {
+    name[1] = '0' + i;
+    json.key(name);
+    json.value(analogRead(i));
+  }
+  json.endObject();
+}
+
+// Web_RSSFeed rssFeedCmd
+static void rssFeedCmd(WebServer &server, WebServer::ConnectionType type,
+                       char *url_tail, bool tail_complete)
+{
+  server.httpSuccess("application/rss+xml; charset=utf-8", NULL,
+                     WebServer::CHUNKED);
+  if (type != WebServer::GET)
+    return;
+
+  P(channelStart) =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>"
+    "<rss version=\"2.0\">"
+    "<channel>"
+    "<title>Webduino RSS Feed Example</title>"
+    "<description>This is an example of serving RSS feeds from an Arduino web server.</description>"
+    "<link>http://webduino.googlecode.com</link>";
+  P(channelEnd) = "</channel></rss>";
+  P(itemStart) = "<item><description>";
+  P(itemEnd) = "</description></item>\n";
+
+  server.printP(channelStart);
+  for (int i = 0; i < 20; ++i)
+  {
+    server.printP(itemStart);
+    server.print("time = ");
+    server.print(i * -15);
+    server.print(" seconds, light = ");
+    server.print(analogRead(i));
+    server.printP(itemEnd);
+  }
+  server.printP(channelEnd);
+}
+
+// the RSS feed again, kept in the response cache for a second
+static void cachedFeedCmd(WebServer &server, WebServer::ConnectionType type,
+                          char *url_tail, bool tail_complete)
+{
+  if (!server.cachedResponse(1000))
+    rssFeedCmd(server, type, url_tail, tail_complete);
+}
+
+// Web_Demo formCmd: radio buttons on GET, readPOSTparam on POST
+static void formCmd(WebServer &server, WebServer::ConnectionType type,
+                    char *url_tail, bool tail_complete)
+{
+  if (type == WebServer::POST)
+  {
+    bool repeat;
+    char name[16], value[16];
+    do
+    {
+      repeat = server.readPOSTparam(name, 16, value, 16);
+    } while (repeat);
+
+    server.httpSeeOther("/form");
+    return;
+  }
+
+  server.httpSuccess("text/html; charset=utf-8", NULL, WebServer::MEASURE);
+  if (type == WebServer::HEAD)
+    return;
+
+  server << "<form action='/form' method='post'><h1>Digital Pins</h1><p>";
+  for (int i = 0; i <= 9; ++i)
+  {
+    int val = digitalRead(i);
+    char pinName[4];
+    pinName[0] = 'd';
+    pinName[1] = '0' + i;
+    pinName[2] = 0;
+    server << "Digital " << i << ": ";
+    server.radioButton(pinName, "1", "On", val);
+    server << " ";
+    server.radioButton(pinName, "0", "Off", !val);
+    server << "<br/>";
+  }
+  server << "</p><input type='submit' value='Submit'/></form>";
+}
+
+// Web_Parms_1 parsedCmd, with the parameters found by URLParams
+static void parsedCmd(WebServer &server, WebServer::ConnectionType type,
+                      char *url_tail, bool tail_complete)
+{
+  server.httpSuccess();
+  if (type == WebServer::HEAD)
+    return;
+
+  WebServer::URLParams params;
+  params.parse(url_tail);
+  for (uint8_t i = 0; i < params.count; ++i)
+  {
+    server.print(params.params[i].name);
+    server.print(" = '");
+    server.print(params.params[i].value);
+    server.print("'<br>\n");
+  }
+}
+
+// a form with a file input, which a browser sends as multipart/form-data
+static char contentType[96];
+
+static bool uploadPart(WebServer &server, WebServer::PartEvent event,
+                       const char *data, size_t length, void *context)
+{
+  if (event == WebServer::PART_DATA)
+    *(long *)context += length;
+  return true;
+}
+
+static void uploadCmd(WebServer &server, WebServer::ConnectionType type,
+                      char *url_tail, bool tail_complete)
+{
+  long received = 0;
+  if (type != WebServer::POST ||
+      !server.readMultipart(contentType, &uploadPart, &received))
+  {
+    server.httpFail();
+    return;
+  }
+
+  server.httpSuccess("text/plain", NULL, WebServer::CHUNKED);
+  server.print(received);
+  server.print(" bytes\n");
+}
+
+// a configuration file PUT whole, collected into blocks the size of
+// an SD card page before being "written"
+static int storeBlock(WebServer &server, const char *data, size_t length,
+                      long offset, void *context)
+{
+  unsigned long *sum = (unsigned long *)context;
+  for (size_t i = 0; i < length; ++i)
+    *sum = *sum * 31 + (uint8_t)data[i];
+  return length;
+}
+
+static void storeCmd(WebServer &server, WebServer::ConnectionType type,
+                     char *url_tail, bool tail_complete)
+{
+  char block[128];
+  unsigned long sum = 0;
+  if (type != WebServer::PUT ||
+      server.readBody(&storeBlock, &sum, block, sizeof(block)) !=
+      WebServer::BODY_COMPLETE)
+  {
+    server.httpFail();
+    return;
+  }
+
+  server.httpSuccess("text/plain", NULL, WebServer::CHUNKED);
+  server.print(server.contentLength());
+  server.print(" bytes, sum ");
+  server.print(sum, HEX);
+  server.print("\n");
+}
+
+/********************************************************************
+ * ROUTE TABLE
+ ********************************************************************/
+
+// pages of a bigger sketch, so the lookup has something to search
+P(pathAbout) = "about";
+P(pathAnalog) = "analog";
+P(pathApi) = "api/";
+P(pathConfig) = "config";
+P(pathDigital) = "digital";
+P(pathEeprom) = "eeprom";
+P(pathFavicon) = "favicon.ico";
+P(pathFeedXml) = "feed.xml";
+P(pathForm) = "form";
+P(pathHelp) = "help";
+P(pathIndex) = "index.html";
+P(pathJson) = "json";
+P(pathLedPng) = "led.png";
+P(pathLog) = "log";
+P(pathLogin) = "login";
+P(pathLogout) = "logout";
+P(pathNetwork) = "network";
+P(pathParsed) = "parsed";
+P(pathPins) = "pins";
+P(pathPwm) = "pwm";
+P(pathReboot) = "reboot";
+P(pathRelay) = "relay";
+P(pathRssXml) = "rss.xml";
+P(pathScript) = "script.js";
+P(pathSensors) = "sensors";
+P(pathServo) = "servo";
+P(pathSettings) = "settings";
+P(pathStatic) = "static/";
+P(pathStatus) = "status";
+P(pathStyle) = "style.css";
+P(pathTemp) = "temp";
+P(pathTime) = "time";
+P(pathUpload) = "upload";
+P(pathUptime) = "uptime";
+P(pathWifi) = "wifi";
+
+#define ROUTE(path, flags, cmd) { path, WebServer::flags, &cmd }
+#define PREFIX_GET (WebServer::ROUTE_PREFIX | WebServer::ROUTE_GET)
+
+static const WebServer::Route routes[] PROGMEM =
+{
+  ROUTE(pathAbout, ROUTE_GET, defaultCmd),
+  ROUTE(pathAnalog, ROUTE_GET, jsonCmd),
+  { pathApi, PREFIX_GET, &parsedCmd },
+  ROUTE(pathConfig, ROUTE_PUT, storeCmd),
+  ROUTE(pathConfig, ROUTE_ANY, formCmd),
+  ROUTE(pathDigital, ROUTE_GET, jsonCmd),
+  ROUTE(pathEeprom, ROUTE_GET, defaultCmd),
+  ROUTE(pathFavicon, ROUTE_GET, imageCmd),
+  ROUTE(pathFeedXml, ROUTE_GET, cachedFeedCmd),
+  ROUTE(pathForm, ROUTE_GET, formCmd),
+  ROUTE(pathForm, ROUTE_POST, formCmd),
+  ROUTE(pathHelp, ROUTE_GET, defaultCmd),
+  ROUTE(pathIndex, ROUTE_GET, defaultCmd),
+  ROUTE(pathJson, ROUTE_GET, jsonCmd),
+  ROUTE(pathLedPng, ROUTE_GET, imageCmd),
+  ROUTE(pathLog, ROUTE_GET, rssFeedCmd),
+  ROUTE(pathLogin, ROUTE_POST, formCmd),
+  ROUTE(pathLogout, ROUTE_POST, formCmd),
+  ROUTE(pathNetwork, ROUTE_ANY, formCmd),
+  ROUTE(pathParsed, ROUTE_GET, parsedCmd),
+  ROUTE(pathPins, ROUTE_GET, jsonCmd),
+  ROUTE(pathPwm, ROUTE_POST, formCmd),
+  ROUTE(pathReboot, ROUTE_POST, formCmd),
+  ROUTE(pathRelay, ROUTE_ANY, formCmd),
+  ROUTE(pathRssXml, ROUTE_GET, rssFeedCmd),
+  ROUTE(pathScript, ROUTE_GET, defaultCmd),
+  ROUTE(pathSensors, ROUTE_GET, jsonWriterCmd),
+  ROUTE(pathServo, ROUTE_POST, formCmd),
+  ROUTE(pathSettings, ROUTE_ANY, formCmd),
+  { pathStatic, PREFIX_GET, &defaultCmd },
+  ROUTE(pathStatus, ROUTE_GET, jsonCmd),
+  ROUTE(pathStyle, ROUTE_GET, defaultCmd),
+  ROUTE(pathTemp, ROUTE_GET, jsonCmd),
+  ROUTE(pathTime, ROUTE_GET, jsonCmd),
+  ROUTE(pathUpload, ROUTE_POST, uploadCmd),
+  ROUTE(pathUptime, ROUTE_GET, jsonCmd),
+  ROUTE(pathWifi, ROUTE_ANY, formCmd),
+};
+
+/********************************************************************
+ * ASSETS
+ ********************************************************************/
+
+P(assetPath) = "img/led.png";
+P(pngType) = "image/png";
+P(ledEtag) = "led-1";
+
+static const WebServer::Asset assets[] PROGMEM =
+{
+  { assetPath, pngType, ledEtag, ledData, sizeof(ledData) },
+  { asset_style_css_path, asset_style_css_type, asset_style_css_etag,
+    asset_style_css_data, sizeof(asset_style_css_data),
+    asset_style_css_gzip, sizeof(asset_style_css_gzip) },
+};
+
+/********************************************************************
+ * CAPTURED HEADERS
+ ********************************************************************/
+
+P(hostHeader) = "host";
+P(acceptEncodingHeader) = "accept-encoding";
+P(authorizationHeader) = "authorization";
+P(connectionHeader) = "connection";
+P(contentTypeHeader) = "content-type";
+
+static char host[32];
+static char acceptEncoding[24];
+static char authorization[48];
+static char connection[16];
+
+/********************************************************************
+ * REQUEST CORPUS
+ ********************************************************************/
+
+// headers a desktop browser sends with every request; most of the
+// request bytes the server has to wade through are these
+#define BROWSER_HEADERS \
+  "Host: 192.168.1.64" CRLF \
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:2.0) Gecko/20100101 Firefox/4.0" CRLF \
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8" CRLF \
+  "Accept-Language: en-us,en;q=0.5" CRLF \
+  "Accept-Encoding: gzip, deflate" CRLF \
+  "Accept-Charset: ISO-8859-1,utf-8;q=0.7,*;q=0.7" CRLF \
+  "Connection: keep-alive" CRLF
+
+// 64 bytes of a configuration file
+#define CONFIG_LINE \
+  "relay1=on;relay2=off;pwm=128;servo=90;alarm=0700;name=kitchen1;\n"
+
+struct BenchRequest
+{
+  const char *name;
+  const char *request;
+  const char *expectStatus;   // status code the response must carry
+};
+
+static const BenchRequest corpus[] =
+{
+  { "index", "GET / HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "image", "GET /led.png HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "asset", "GET /img/led.png HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "cached", "GET /img/led.png HTTP/1.1" CRLF BROWSER_HEADERS
+    "If-None-Match: \"led-1\"" CRLF CRLF,
+    "304" },
+  { "range", "GET /img/led.png HTTP/1.1" CRLF BROWSER_HEADERS
+    "Range: bytes=100-199" CRLF CRLF,
+    "206" },
+  { "gzip", "GET /style.css HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "plain", "GET /style.css HTTP/1.1" CRLF "Host: 192.168.1.64" CRLF CRLF,
+    "200" },
+  { "json", "GET /json HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "writer", "GET /sensors HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "rss", "GET /rss.xml HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "feed", "GET /feed.xml HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "form", "GET /form HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+  { "params", "GET /parsed?led=on&level=128&name=Arduino%20Uno HTTP/1.1" CRLF
+    BROWSER_HEADERS CRLF,
+    "200" },
+  { "post", "POST /form HTTP/1.1" CRLF BROWSER_HEADERS
+    "Content-Type: application/x-www-form-urlencoded" CRLF
+    "Content-Length: 39" CRLF CRLF
+    "d0=1&d1=0&d2=1&d3=0&d4=1&d5=0&d6=1&d7=0",
+    "303" },
+  { "upload", "POST /upload HTTP/1.1" CRLF BROWSER_HEADERS
+    "Content-Type: multipart/form-data; "
+    "boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW" CRLF
+    "Content-Length: 377" CRLF CRLF
+    "------WebKitFormBoundary7MA4YWxkTrZu0gW" CRLF
+    "Content-Disposition: form-data; name=\"label\"" CRLF CRLF
+    "kitchen" CRLF
+    "------WebKitFormBoundary7MA4YWxkTrZu0gW" CRLF
+    "Content-Disposition: form-data; name=\"config\"; "
+    "filename=\"config.txt\"" CRLF
+    "Content-Type: text/plain" CRLF CRLF
+    "pin0=off" CRLF "pin1=on" CRLF "pin2=off" CRLF "pin3=on" CRLF
+    "pin4=off" CRLF "pin5=on" CRLF "pin6=off" CRLF "pin7=on" CRLF
+    "pin8=off" CRLF "pin9=on" CRLF CRLF
+    "------WebKitFormBoundary7MA4YWxkTrZu0gW--" CRLF,
+    "200" },
+  { "put", "PUT /config HTTP/1.1" CRLF "Host: 192.168.1.64" CRLF
+    "Content-Type: application/octet-stream" CRLF
+    "Content-Length: 512" CRLF CRLF
+    CONFIG_LINE CONFIG_LINE CONFIG_LINE CONFIG_LINE
+    CONFIG_LINE CONFIG_LINE CONFIG_LINE CONFIG_LINE,
+    "200" },
+  { "robots", "GET /robots.txt HTTP/1.0" CRLF CRLF,
+    "200" },
+  { "missing", "GET /nothing/here HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "400" },
+#ifdef WEBDUINO_STATUS_URL
+  { "status", "GET " WEBDUINO_STATUS_URL " HTTP/1.1" CRLF BROWSER_HEADERS CRLF,
+    "200" },
+#endif
+};
+
+/********************************************************************
+ * DRIVER
+ ********************************************************************/
+
+WebServer webserver("", 80);
+static bool keepAlive = false;
+static bool useRoutes = false;
+static int openSock = -1;
+static unsigned long connects;
+static size_t pollChunk = 0;
+static unsigned long long worstPoll;
+
+static bool goodResponse(const BenchRequest &req, int sock)
+{
+  // "HTTP/1.x nnn"
+  const std::string &tx = HostNet::sockets[sock].tx;
+  return tx.size() > 12 && tx.compare(0, 7, "HTTP/1.") == 0 &&
+    tx.compare(9, 3, req.expectStatus) == 0;
+}
+
+static bool runOnce(const BenchRequest &req, unsigned long long *elapsed)
+{
+  int sock = openSock;
+  if (sock >= 0 && !HostNet::sockets[sock].stopped)
+  {
+    HostNet::clearTx(sock);
+    HostNet::send(sock, req.request, strlen(req.request));
+  }
+  else
+  {
+    sock = HostNet::connect(80, req.request, strlen(req.request));
+    ++connects;
+    if (sock < 0)
+    {
+      fprintf(stderr, "%s: no listening socket\n", req.name);
+      return false;
+    }
+  }
+  if (keepAlive)
+    openSock = sock;
+
+  unsigned long long start = hostNanos();
+  lastPhaseTime = start;
+  webserver.processConnection();
+  *elapsed += hostNanos() - start;
+
+  return goodResponse(req, sock);
+}
+
+// Run iterations requests through poll(), keeping every socket but the
+// listening one busy with a browser that trickles its request in.
+static unsigned long runPolled(const BenchRequest &req,
+                               unsigned long iterations,
+                               unsigned long long *elapsed)
+{
+  const int browsers = MAX_SOCK_NUM - 1;
+  int socks[browsers];
+  // connections left open by earlier requests, ready for reuse; several
+  // browsers can finish in the same poll()
+  int kept[browsers];
+  int keptCount = 0;
+  unsigned long started = 0, finished = 0, failures = 0;
+  size_t len = strlen(req.request);
+
+  for (int b = 0; b < browsers; ++b)
+    socks[b] = -1;
+
+  while (finished < iterations)
+  {
+    for (int b = 0; b < browsers; ++b)
+    {
+      int sock = socks[b];
+      if (sock < 0)
+      {
+        if (started == iterations)
+          continue;
+        while (keptCount > 0 && HostNet::sockets[kept[keptCount - 1]].stopped)
+          --keptCount;
+        if (keptCount > 0)
+        {
+          // reuse a connection left open by an earlier request
+          sock = kept[--keptCount];
+          HostNet::clearTx(sock);
+          HostNet::sockets[sock].rx.append(req.request, len);
+          // the first chunk arrives straight away, as on a new
+          // connection, or the server sees an idle connection it may
+          // close to free the socket
+          HostNet::feed(sock, pollChunk);
+        }
+        else
+        {
+          sock = HostNet::connect(80, req.request, len, pollChunk);
+          if (sock < 0)
+            continue;
+          ++connects;
+        }
+        socks[b] = sock;
+        ++started;
+      }
+      else
+        HostNet::feed(sock, pollChunk);
+    }
+
+    for (int b = 0; b < browsers; ++b)
+      if (socks[b] >= 0)
+        HostNet::sockets[socks[b]].emptyChecks = 0;
+
+    unsigned long long start = hostNanos();
+    lastPhaseTime = start;
+    webserver.poll();
+    unsigned long long took = hostNanos() - start;
+    *elapsed += took;
+    if (took > worstPoll)
+      worstPoll = took;
+
+    for (int b = 0; b < browsers; ++b)
+    {
+      int sock = socks[b];
+      if (sock < 0)
+        continue;
+      HostSocket &s = HostNet::sockets[sock];
+      if (s.stopped || (!s.tx.empty() && s.rxPos == s.rx.size()))
+      {
+        if (!goodResponse(req, sock))
+          ++failures;
+        ++finished;
+        socks[b] = -1;
+        if (!s.stopped)
+          kept[keptCount++] = sock;
+      }
+    }
+  }
+
+  return failures;
+}
+
+static void report(const BenchRequest &req, unsigned long iterations,
+                   unsigned long long elapsed, unsigned long failures)
+{
+  double seconds = elapsed / 1e9;
+  printf("%-8s %10.0f req/s %7.1f B/req %6.1f writes/req %7.1f reads/req",
+         req.name, iterations / seconds,
+         (double)HostNet::bytesWritten / iterations,
+         (double)HostNet::writeCalls / iterations,
+         (double)HostNet::readCalls / iterations);
+  if (keepAlive)
+    printf(" %5.2f conns/req", (double)connects / iterations);
+  if (pollChunk)
+    printf(" %7.2fus worst poll", worstPoll / 1e3);
+  if (failures)
+    printf("  %lu BAD RESPONSES", failures);
+  printf("\n        ");
+  for (int i = 0; i < STEP_COUNT; ++i)
+  {
+    if (stepStats[i].count == 0)
+      continue;
+    printf(" %s %.2f/%.2fus", stepNames[i],
+           stepStats[i].total / 1e3 / stepStats[i].count,
+           stepStats[i].worst / 1e3);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  while (argc > 1 && argv[1][0] == '-')
+  {
+    if (strcmp(argv[1], "-k") == 0)
+      keepAlive = true;
+    else if (strcmp(argv[1], "-r") == 0)
+      useRoutes = true;
+    else if (strcmp(argv[1], "-p") == 0 && argc > 2)
+    {
+      pollChunk = strtoul(argv[2], NULL, 10);
+      HostNet::stallRelease = pollChunk;
+      --argc;
+      ++argv;
+    }
+    --argc;
+    ++argv;
+  }
+
+  unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 20000;
+  const char *only = (argc > 2) ? argv[2] : NULL;
+  bool allGood = true;
+
+  if (keepAlive)
+    webserver.setKeepAlive(WEBDUINO_KEEP_ALIVE_TIMEOUT_IN_MS, 255);
+
+  webserver.captureHeader(hostHeader, host, sizeof(host));
+  webserver.captureHeader(acceptEncodingHeader, acceptEncoding,
+                          sizeof(acceptEncoding));
+  webserver.captureHeader(authorizationHeader, authorization,
+                          sizeof(authorization));
+  webserver.captureHeader(connectionHeader, connection, sizeof(connection));
+  webserver.captureHeader(contentTypeHeader, contentType,
+                          sizeof(contentType));
+  // If-None-Match is captured by setAssets
+  webserver.setAssets(assets, SIZE(assets));
+  // room for the feed, headers, chunks and all
+  static char cache[3072];
+  webserver.setCache(cache, sizeof(cache));
+  webserver.setDefaultCommand(&defaultCmd);
+  if (useRoutes)
+    webserver.setRoutes(routes, SIZE(routes));
+  else
+  {
+    webserver.addCommand("led.png", &imageCmd);
+    webserver.addCommand("json", &jsonCmd);
+    webserver.addCommand("rss.xml", &rssFeedCmd);
+    webserver.addCommand("feed.xml", &cachedFeedCmd);
+    webserver.addCommand("form", &formCmd);
+    webserver.addCommand("parsed", &parsedCmd);
+    webserver.addCommand("upload", &uploadCmd);
+    webserver.addCommand("config", &storeCmd);
+    webserver.addCommand("sensors", &jsonWriterCmd);
+  }
+  webserver.begin();
+
+  printf("%lu iterations per request; phase times are mean/worst\n\n",
+         iterations);
+
+  for (size_t r = 0; r < SIZE(corpus); ++r)
+  {
+    const BenchRequest &req = corpus[r];
+    if (only && strcmp(only, req.name) != 0)
+      continue;
+
+    unsigned long long elapsed = 0;
+    unsigned long failures = 0;
+
+    memset(stepStats, 0, sizeof(stepStats));
+    HostNet::resetStats();
+    connects = 0;
+    worstPoll = 0;
+    if (pollChunk)
+      failures = runPolled(req, iterations, &elapsed);
+    else
+    {
+      for (unsigned long i = 0; i < iterations; ++i)
+      {
+        if (!runOnce(req, &elapsed))
+          ++failures;
+      }
+    }
+
+    report(req, iterations, elapsed, failures);
+    if (failures)
+      allGood = false;
+  }
+
+  return allGood ? 0 : 1;
+}
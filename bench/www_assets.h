@@ -0,0 +1,147 @@
+// Generated by tools/pack_assets.py from www; do not edit.
+
+#include "WebServer.h"
+
+// style.css: 1467 bytes, 575 gzipped
+P(asset_style_css_path) = "style.css";
+P(asset_style_css_type) = "text/css";
+P(asset_style_css_etag) = "051167eb7e00";
+P(asset_style_css_data) = {
+  0x2f, 0x2a, 0x20, 0x73, 0x74, 0x79, 0x6c, 0x65, 0x20, 0x73, 0x68, 0x65, 0x65, 0x74, 0x20, 0x66,
+  0x6f, 0x72, 0x20, 0x74, 0x68, 0x65, 0x20, 0x62, 0x65, 0x6e, 0x63, 0x68, 0x6d, 0x61, 0x72, 0x6b,
+  0x27, 0x73, 0x20, 0x63, 0x6f, 0x6e, 0x74, 0x72, 0x6f, 0x6c, 0x20, 0x70, 0x61, 0x6e, 0x65, 0x6c,
+  0x20, 0x70, 0x61, 0x67, 0x65, 0x73, 0x20, 0x2a, 0x2f, 0x0a, 0x68, 0x74, 0x6d, 0x6c, 0x2c, 0x20,
+  0x62, 0x6f, 0x64, 0x79, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x6d, 0x61, 0x72, 0x67, 0x69, 0x6e, 0x3a,
+  0x20, 0x30, 0x3b, 0x0a, 0x20, 0x20, 0x70, 0x61, 0x64, 0x64, 0x69, 0x6e, 0x67, 0x3a, 0x20, 0x30,
+  0x3b, 0x0a, 0x20, 0x20, 0x66, 0x6f, 0x6e, 0x74, 0x2d, 0x66, 0x61, 0x6d, 0x69, 0x6c, 0x79, 0x3a,
+  0x20, 0x22, 0x48, 0x65, 0x6c, 0x76, 0x65, 0x74, 0x69, 0x63, 0x61, 0x20, 0x4e, 0x65, 0x75, 0x65,
+  0x22, 0x2c, 0x20, 0x48, 0x65, 0x6c, 0x76, 0x65, 0x74, 0x69, 0x63, 0x61, 0x2c, 0x20, 0x41, 0x72,
+  0x69, 0x61, 0x6c, 0x2c, 0x20, 0x73, 0x61, 0x6e, 0x73, 0x2d, 0x73, 0x65, 0x72, 0x69, 0x66, 0x3b,
+  0x0a, 0x20, 0x20, 0x66, 0x6f, 0x6e, 0x74, 0x2d, 0x73, 0x69, 0x7a, 0x65, 0x3a, 0x20, 0x31, 0x34,
+  0x70, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x6c, 0x69, 0x6e, 0x65, 0x2d, 0x68, 0x65, 0x69, 0x67, 0x68,
+  0x74, 0x3a, 0x20, 0x31, 0x2e, 0x34, 0x3b, 0x0a, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a,
+  0x20, 0x23, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x61, 0x63, 0x6b,
+  0x67, 0x72, 0x6f, 0x75, 0x6e, 0x64, 0x2d, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x66,
+  0x34, 0x66, 0x34, 0x66, 0x34, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x68, 0x31, 0x2c, 0x20, 0x68, 0x32,
+  0x2c, 0x20, 0x68, 0x33, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x6d, 0x61, 0x72, 0x67, 0x69, 0x6e, 0x3a,
+  0x20, 0x30, 0x20, 0x30, 0x20, 0x30, 0x2e, 0x35, 0x65, 0x6d, 0x20, 0x30, 0x3b, 0x0a, 0x20, 0x20,
+  0x66, 0x6f, 0x6e, 0x74, 0x2d, 0x77, 0x65, 0x69, 0x67, 0x68, 0x74, 0x3a, 0x20, 0x6e, 0x6f, 0x72,
+  0x6d, 0x61, 0x6c, 0x3b, 0x0a, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x31,
+  0x61, 0x35, 0x32, 0x37, 0x36, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x23, 0x68, 0x65, 0x61, 0x64, 0x65,
+  0x72, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x70, 0x61, 0x64, 0x64, 0x69, 0x6e, 0x67, 0x3a, 0x20, 0x31,
+  0x30, 0x70, 0x78, 0x20, 0x32, 0x30, 0x70, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x6f,
+  0x72, 0x3a, 0x20, 0x23, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x61,
+  0x63, 0x6b, 0x67, 0x72, 0x6f, 0x75, 0x6e, 0x64, 0x2d, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20,
+  0x23, 0x31, 0x61, 0x35, 0x32, 0x37, 0x36, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x6f, 0x72, 0x64, 0x65,
+  0x72, 0x2d, 0x62, 0x6f, 0x74, 0x74, 0x6f, 0x6d, 0x3a, 0x20, 0x33, 0x70, 0x78, 0x20, 0x73, 0x6f,
+  0x6c, 0x69, 0x64, 0x20, 0x23, 0x31, 0x35, 0x34, 0x33, 0x36, 0x30, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a,
+  0x23, 0x68, 0x65, 0x61, 0x64, 0x65, 0x72, 0x20, 0x68, 0x31, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x63,
+  0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3b, 0x0a, 0x7d,
+  0x0a, 0x0a, 0x23, 0x63, 0x6f, 0x6e, 0x74, 0x65, 0x6e, 0x74, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x6d,
+  0x61, 0x72, 0x67, 0x69, 0x6e, 0x3a, 0x20, 0x32, 0x30, 0x70, 0x78, 0x20, 0x61, 0x75, 0x74, 0x6f,
+  0x3b, 0x0a, 0x20, 0x20, 0x70, 0x61, 0x64, 0x64, 0x69, 0x6e, 0x67, 0x3a, 0x20, 0x32, 0x30, 0x70,
+  0x78, 0x3b, 0x0a, 0x20, 0x20, 0x6d, 0x61, 0x78, 0x2d, 0x77, 0x69, 0x64, 0x74, 0x68, 0x3a, 0x20,
+  0x37, 0x32, 0x30, 0x70, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x61, 0x63, 0x6b, 0x67, 0x72, 0x6f,
+  0x75, 0x6e, 0x64, 0x2d, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x66, 0x66, 0x66, 0x66,
+  0x66, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x3a, 0x20, 0x31, 0x70,
+  0x78, 0x20, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x20, 0x23, 0x64, 0x64, 0x64, 0x64, 0x64, 0x64, 0x3b,
+  0x0a, 0x20, 0x20, 0x62, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x2d, 0x72, 0x61, 0x64, 0x69, 0x75, 0x73,
+  0x3a, 0x20, 0x34, 0x70, 0x78, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x74, 0x61, 0x62, 0x6c, 0x65, 0x2e,
+  0x70, 0x69, 0x6e, 0x73, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x3a, 0x20,
+  0x31, 0x30, 0x30, 0x25, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x2d, 0x63,
+  0x6f, 0x6c, 0x6c, 0x61, 0x70, 0x73, 0x65, 0x3a, 0x20, 0x63, 0x6f, 0x6c, 0x6c, 0x61, 0x70, 0x73,
+  0x65, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x74, 0x61, 0x62, 0x6c, 0x65, 0x2e, 0x70, 0x69, 0x6e, 0x73,
+  0x20, 0x74, 0x68, 0x2c, 0x20, 0x74, 0x61, 0x62, 0x6c, 0x65, 0x2e, 0x70, 0x69, 0x6e, 0x73, 0x20,
+  0x74, 0x64, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x70, 0x61, 0x64, 0x64, 0x69, 0x6e, 0x67, 0x3a, 0x20,
+  0x34, 0x70, 0x78, 0x20, 0x38, 0x70, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x74, 0x65, 0x78, 0x74, 0x2d,
+  0x61, 0x6c, 0x69, 0x67, 0x6e, 0x3a, 0x20, 0x6c, 0x65, 0x66, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x62,
+  0x6f, 0x72, 0x64, 0x65, 0x72, 0x2d, 0x62, 0x6f, 0x74, 0x74, 0x6f, 0x6d, 0x3a, 0x20, 0x31, 0x70,
+  0x78, 0x20, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x20, 0x23, 0x65, 0x65, 0x65, 0x65, 0x65, 0x65, 0x3b,
+  0x0a, 0x7d, 0x0a, 0x0a, 0x74, 0x61, 0x62, 0x6c, 0x65, 0x2e, 0x70, 0x69, 0x6e, 0x73, 0x20, 0x74,
+  0x68, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x36, 0x36,
+  0x36, 0x36, 0x36, 0x36, 0x3b, 0x0a, 0x20, 0x20, 0x66, 0x6f, 0x6e, 0x74, 0x2d, 0x77, 0x65, 0x69,
+  0x67, 0x68, 0x74, 0x3a, 0x20, 0x62, 0x6f, 0x6c, 0x64, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x74, 0x61,
+  0x62, 0x6c, 0x65, 0x2e, 0x70, 0x69, 0x6e, 0x73, 0x20, 0x74, 0x64, 0x2e, 0x6f, 0x6e, 0x20, 0x7b,
+  0x0a, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x31, 0x65, 0x38, 0x34, 0x34,
+  0x39, 0x3b, 0x0a, 0x20, 0x20, 0x66, 0x6f, 0x6e, 0x74, 0x2d, 0x77, 0x65, 0x69, 0x67, 0x68, 0x74,
+  0x3a, 0x20, 0x62, 0x6f, 0x6c, 0x64, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x74, 0x61, 0x62, 0x6c, 0x65,
+  0x2e, 0x70, 0x69, 0x6e, 0x73, 0x20, 0x74, 0x64, 0x2e, 0x6f, 0x66, 0x66, 0x20, 0x7b, 0x0a, 0x20,
+  0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x39, 0x32, 0x32, 0x62, 0x32, 0x31, 0x3b,
+  0x0a, 0x7d, 0x0a, 0x0a, 0x66, 0x6f, 0x72, 0x6d, 0x20, 0x70, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x6d,
+  0x61, 0x72, 0x67, 0x69, 0x6e, 0x3a, 0x20, 0x30, 0x20, 0x30, 0x20, 0x31, 0x30, 0x70, 0x78, 0x20,
+  0x30, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x69, 0x6e, 0x70, 0x75, 0x74, 0x5b, 0x74, 0x79, 0x70, 0x65,
+  0x3d, 0x74, 0x65, 0x78, 0x74, 0x5d, 0x2c, 0x20, 0x69, 0x6e, 0x70, 0x75, 0x74, 0x5b, 0x74, 0x79,
+  0x70, 0x65, 0x3d, 0x6e, 0x75, 0x6d, 0x62, 0x65, 0x72, 0x5d, 0x2c, 0x20, 0x73, 0x65, 0x6c, 0x65,
+  0x63, 0x74, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x70, 0x61, 0x64, 0x64, 0x69, 0x6e, 0x67, 0x3a, 0x20,
+  0x34, 0x70, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x3a, 0x20, 0x32, 0x30,
+  0x30, 0x70, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x3a, 0x20, 0x31,
+  0x70, 0x78, 0x20, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x20, 0x23, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63,
+  0x3b, 0x0a, 0x20, 0x20, 0x62, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x2d, 0x72, 0x61, 0x64, 0x69, 0x75,
+  0x73, 0x3a, 0x20, 0x33, 0x70, 0x78, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x62, 0x75, 0x74, 0x74, 0x6f,
+  0x6e, 0x2c, 0x20, 0x69, 0x6e, 0x70, 0x75, 0x74, 0x5b, 0x74, 0x79, 0x70, 0x65, 0x3d, 0x73, 0x75,
+  0x62, 0x6d, 0x69, 0x74, 0x5d, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x70, 0x61, 0x64, 0x64, 0x69, 0x6e,
+  0x67, 0x3a, 0x20, 0x36, 0x70, 0x78, 0x20, 0x31, 0x34, 0x70, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x63,
+  0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3b, 0x0a, 0x20,
+  0x20, 0x62, 0x61, 0x63, 0x6b, 0x67, 0x72, 0x6f, 0x75, 0x6e, 0x64, 0x2d, 0x63, 0x6f, 0x6c, 0x6f,
+  0x72, 0x3a, 0x20, 0x23, 0x32, 0x38, 0x37, 0x34, 0x61, 0x36, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x6f,
+  0x72, 0x64, 0x65, 0x72, 0x3a, 0x20, 0x31, 0x70, 0x78, 0x20, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x20,
+  0x23, 0x31, 0x66, 0x36, 0x31, 0x38, 0x64, 0x3b, 0x0a, 0x20, 0x20, 0x62, 0x6f, 0x72, 0x64, 0x65,
+  0x72, 0x2d, 0x72, 0x61, 0x64, 0x69, 0x75, 0x73, 0x3a, 0x20, 0x33, 0x70, 0x78, 0x3b, 0x0a, 0x20,
+  0x20, 0x63, 0x75, 0x72, 0x73, 0x6f, 0x72, 0x3a, 0x20, 0x70, 0x6f, 0x69, 0x6e, 0x74, 0x65, 0x72,
+  0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x62, 0x75, 0x74, 0x74, 0x6f, 0x6e, 0x3a, 0x68, 0x6f, 0x76, 0x65,
+  0x72, 0x2c, 0x20, 0x69, 0x6e, 0x70, 0x75, 0x74, 0x5b, 0x74, 0x79, 0x70, 0x65, 0x3d, 0x73, 0x75,
+  0x62, 0x6d, 0x69, 0x74, 0x5d, 0x3a, 0x68, 0x6f, 0x76, 0x65, 0x72, 0x20, 0x7b, 0x0a, 0x20, 0x20,
+  0x62, 0x61, 0x63, 0x6b, 0x67, 0x72, 0x6f, 0x75, 0x6e, 0x64, 0x2d, 0x63, 0x6f, 0x6c, 0x6f, 0x72,
+  0x3a, 0x20, 0x23, 0x31, 0x66, 0x36, 0x31, 0x38, 0x64, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x23, 0x66,
+  0x6f, 0x6f, 0x74, 0x65, 0x72, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x70, 0x61, 0x64, 0x64, 0x69, 0x6e,
+  0x67, 0x3a, 0x20, 0x31, 0x30, 0x70, 0x78, 0x20, 0x32, 0x30, 0x70, 0x78, 0x3b, 0x0a, 0x20, 0x20,
+  0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x39, 0x39, 0x39, 0x39, 0x39, 0x39, 0x3b, 0x0a,
+  0x20, 0x20, 0x66, 0x6f, 0x6e, 0x74, 0x2d, 0x73, 0x69, 0x7a, 0x65, 0x3a, 0x20, 0x31, 0x32, 0x70,
+  0x78, 0x3b, 0x0a, 0x20, 0x20, 0x74, 0x65, 0x78, 0x74, 0x2d, 0x61, 0x6c, 0x69, 0x67, 0x6e, 0x3a,
+  0x20, 0x63, 0x65, 0x6e, 0x74, 0x65, 0x72, 0x3b, 0x0a, 0x7d, 0x0a
+};
+P(asset_style_css_gzip) = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x8d, 0x54, 0xcd, 0x8e, 0x9b, 0x30,
+  0x10, 0xbe, 0xe7, 0x29, 0x46, 0xbb, 0x5a, 0x55, 0x5a, 0x85, 0x2c, 0x10, 0x42, 0x12, 0xa2, 0x1e,
+  0x7a, 0xeb, 0xa9, 0x2f, 0x50, 0xed, 0xc1, 0xe0, 0x01, 0x5b, 0x6b, 0x6c, 0x64, 0x9b, 0xdd, 0xa4,
+  0x55, 0xdf, 0xbd, 0xc6, 0x09, 0x09, 0x84, 0x44, 0xca, 0x20, 0x10, 0x1e, 0x7b, 0xe6, 0xfb, 0xe6,
+  0xcf, 0x6f, 0xaf, 0x60, 0xec, 0x41, 0x20, 0x18, 0x86, 0x68, 0xa1, 0x54, 0x1a, 0x2c, 0x43, 0xc8,
+  0x51, 0x16, 0xac, 0x26, 0xfa, 0xe3, 0x9b, 0x81, 0x42, 0x49, 0xab, 0x95, 0x80, 0x86, 0x48, 0xec,
+  0xbe, 0x15, 0x1a, 0x78, 0x7d, 0x9b, 0x31, 0x5b, 0x8b, 0x39, 0xe4, 0x8a, 0x1e, 0xe0, 0xef, 0x0c,
+  0xc0, 0x1d, 0xae, 0xb8, 0xcc, 0x20, 0xdc, 0xb9, 0x45, 0x43, 0x28, 0xe5, 0xb2, 0x3a, 0xad, 0x4a,
+  0xe7, 0x20, 0x28, 0x49, 0xcd, 0xc5, 0x21, 0x83, 0xa7, 0x9f, 0x28, 0x3e, 0xd1, 0xf2, 0x82, 0xc0,
+  0x2f, 0x6c, 0xf1, 0x69, 0x0e, 0x67, 0xc5, 0x1c, 0x7e, 0x68, 0x4e, 0x9c, 0x53, 0x43, 0xa4, 0x09,
+  0x0c, 0x6a, 0x5e, 0x9e, 0xcd, 0x0d, 0xff, 0x83, 0x19, 0x44, 0x49, 0xb3, 0xef, 0x54, 0x82, 0x4b,
+  0x0c, 0x18, 0xf2, 0x8a, 0x59, 0xa7, 0x5c, 0x24, 0x9d, 0xae, 0x50, 0x42, 0xe9, 0x0c, 0x9e, 0x97,
+  0x5e, 0x3a, 0x4d, 0x4e, 0x8a, 0x8f, 0x4a, 0xab, 0x56, 0xd2, 0xa0, 0xdf, 0x2c, 0x93, 0xee, 0xd9,
+  0xcd, 0xfe, 0xcd, 0x66, 0x2c, 0x9a, 0x03, 0x8b, 0xdd, 0xbb, 0x1c, 0xf3, 0xef, 0x9e, 0xc5, 0x0a,
+  0xeb, 0x01, 0xf7, 0xaf, 0x13, 0x92, 0x54, 0xba, 0x26, 0x62, 0x08, 0x16, 0x91, 0x55, 0xbc, 0x4e,
+  0xbd, 0xbf, 0x67, 0x86, 0x84, 0xa2, 0xf6, 0xce, 0xce, 0xf1, 0x47, 0x61, 0xb3, 0x87, 0x38, 0x3c,
+  0xb2, 0x3e, 0x93, 0xf0, 0x72, 0x87, 0x61, 0xef, 0xd1, 0x6d, 0x2a, 0xed, 0xfc, 0x05, 0xb9, 0xb2,
+  0x56, 0xd5, 0x19, 0x2c, 0x9d, 0x27, 0xa3, 0x04, 0xa7, 0xee, 0xcc, 0x2a, 0x59, 0xa6, 0xe1, 0x08,
+  0x95, 0x45, 0x1e, 0xf8, 0x1a, 0xa2, 0x3b, 0xd1, 0xd5, 0x0f, 0xa5, 0x1d, 0x45, 0xd9, 0x51, 0x02,
+  0xd2, 0x5a, 0x35, 0xaa, 0x56, 0x4f, 0xb4, 0x26, 0xfb, 0xe0, 0x8b, 0x53, 0xcb, 0x32, 0x58, 0xf7,
+  0xba, 0x5b, 0xc9, 0xbc, 0xc4, 0xe1, 0xa9, 0xba, 0x70, 0x2f, 0x1c, 0xa9, 0x97, 0x41, 0x1c, 0x9a,
+  0x50, 0xde, 0x9a, 0x0c, 0x7c, 0x09, 0x1d, 0x2f, 0x4b, 0x72, 0x81, 0x8b, 0x86, 0x4b, 0xe3, 0x99,
+  0x9d, 0xf0, 0xa2, 0x30, 0x7c, 0x19, 0x18, 0x39, 0x28, 0x41, 0x1a, 0xe3, 0x4a, 0xdf, 0xff, 0x5d,
+  0xdb, 0x5a, 0x36, 0x87, 0xe1, 0x92, 0x8e, 0x0b, 0xe0, 0xd0, 0x60, 0x73, 0x8c, 0xc0, 0xe2, 0xde,
+  0x06, 0x44, 0xf0, 0xca, 0xc5, 0x2f, 0xb0, 0xb4, 0x37, 0x72, 0x3c, 0xe0, 0x8f, 0x5e, 0xa6, 0x68,
+  0xa3, 0x34, 0xa7, 0x5e, 0x26, 0x7d, 0x92, 0x2b, 0x41, 0x27, 0x96, 0x74, 0xa1, 0xe4, 0xc8, 0x38,
+  0xc2, 0x4d, 0x92, 0x6c, 0x1f, 0x36, 0x2e, 0xcb, 0x91, 0xf5, 0x36, 0x8e, 0xf3, 0x38, 0xf2, 0x07,
+  0xdd, 0xd0, 0xd6, 0xd0, 0x4c, 0xba, 0xd8, 0xf7, 0xde, 0xb1, 0x4b, 0xb8, 0x6c, 0x5a, 0xfb, 0xdb,
+  0x1e, 0x1a, 0xfc, 0xde, 0x65, 0xe1, 0x7d, 0x0e, 0x03, 0x8d, 0x6c, 0xeb, 0x1c, 0xb5, 0xd3, 0x19,
+  0x14, 0x58, 0xd8, 0x49, 0xfe, 0x76, 0x97, 0xea, 0xc4, 0x61, 0xdf, 0x0d, 0xd3, 0x82, 0x17, 0x5e,
+  0x6e, 0x14, 0x7c, 0x79, 0x2a, 0x78, 0xde, 0xba, 0x24, 0xcb, 0x11, 0xb4, 0x69, 0xf3, 0x9a, 0xdb,
+  0xf7, 0x31, 0x64, 0xea, 0x7c, 0xf6, 0x83, 0xfe, 0xd0, 0xc8, 0xc4, 0x9b, 0x75, 0x42, 0xd2, 0x3b,
+  0xb4, 0xa2, 0x32, 0x8d, 0x36, 0xf4, 0x1e, 0x2d, 0x87, 0xd0, 0x6a, 0xd3, 0x79, 0x69, 0x14, 0x77,
+  0x63, 0xa2, 0x07, 0x4c, 0x33, 0xa6, 0x3e, 0x51, 0xdf, 0xe2, 0x7b, 0xdc, 0xf1, 0xac, 0x6f, 0x4d,
+  0xf0, 0x09, 0xb1, 0x9b, 0xbd, 0x52, 0x29, 0xfb, 0xd0, 0x9d, 0xb0, 0xf5, 0x72, 0x7d, 0xdd, 0xc5,
+  0xd3, 0xce, 0x2d, 0xb0, 0xa7, 0xf9, 0x1f, 0x7d, 0x10, 0x22, 0xa8, 0xbb, 0x05, 0x00, 0x00
+};
+
+static const WebServer::Asset wwwAssets[] PROGMEM =
+{
+  { asset_style_css_path, asset_style_css_type, asset_style_css_etag,
+    asset_style_css_data, sizeof(asset_style_css_data),
+    asset_style_css_gzip, sizeof(asset_style_css_gzip) }
+};
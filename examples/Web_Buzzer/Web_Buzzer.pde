@@ -1,6 +1,10 @@
 /* Web_Buzzer.pde - example sketch for Webduino library */
 
 #include "Ethernet.h"
+
+/* the buzzer can also be driven over a WebSocket */
+#define WEBDUINO_FEATURES WEBDUINO_FEATURE_WEBSOCKETS
+
 #include "WebServer.h"
 
 /* CHANGE THIS TO YOUR OWN UNIQUE VALUE.  The MAC number should be
@@ -31,6 +35,36 @@ int buzzDelay = 0;
 iteration. */
 char toggle = 0;
 
+/* the message the page is sending over its WebSocket, which is a new
+ * delay as text */
+char message[8];
+uint8_t messageLength = 0;
+
+/* This function is told what happens on the WebSocket the page opens.
+ * Each message arrives a piece at a time, so keep what fits of it until
+ * it's over, then use it as the new delay. */
+void buzzSocket(WebServer &server, WebServer::SocketEvent event, const char *data, size_t length)
+{
+  if (event == WebServer::SOCKET_TEXT)
+  {
+    while (length-- > 0 && messageLength < sizeof(message) - 1)
+      message[messageLength++] = *data++;
+  }
+  else if (event == WebServer::SOCKET_END)
+  {
+    message[messageLength] = 0;
+    messageLength = 0;
+    buzzDelay = strtoul(message, NULL, 10);
+  }
+}
+
+/* This command is set as the handler for /buzz/socket.  It turns the
+ * request into a WebSocket that buzzSocket looks after from then on. */
+void socketCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  server.httpWebSocket(&buzzSocket);
+}
+
 /* This command is set as the default command for the server.  It
  * handles both GET and POST requests.  For a GET, it returns a simple
  * page with some buttons.  For a POST, it saves the value posted to
@@ -84,7 +118,18 @@ void buzzCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail,
       "<p><button name='buzz' value='1975'>1975</button></p>"
       "<p><button name='buzz' value='3000'>3000</button></p>"
       "<p><button name='buzz' value='8000'>8000</button></p>"
-      "</form></body></html>";
+      "</form>"
+      /* browsers that can open a WebSocket send the button values down
+       * it instead of posting the form, which is much quicker */
+      "<script>\n"
+      "if (window.WebSocket) {\n"
+        "var socket = new WebSocket('ws://' + location.host + '" PREFIX "/socket');\n"
+        "socket.onopen = function() {\n"
+          "var buttons = document.getElementsByTagName('button');\n"
+          "for (var i = 0; i < buttons.length; ++i)\n"
+            "buttons[i].onclick = function() { socket.send(this.value); return false; }; };\n"
+      "}\n"
+      "</script></body></html>";
 
     server.printP(message);
   }
@@ -102,6 +147,10 @@ void setup()
    * http://x.x.x.x/buzz */
   webserver.setDefaultCommand(&buzzCmd);
 
+  /* and the WebSocket the page opens */
+  webserver.enableWebSockets();
+  webserver.addCommand("socket", &socketCmd);
+
   /* start the server to wait for connections */
   webserver.begin();
 }
@@ -1,6 +1,12 @@
 /* Web_LightBox.pde - example sketch for Webduino library */
 
 #include "Ethernet.h"
+
+/* the light level is sent as an event stream, and light.json answers
+ * kept in the response cache */
+#define WEBDUINO_FEATURES \
+  (WEBDUINO_FEATURE_EVENTS | WEBDUINO_FEATURE_CACHE)
+
 #include "WebServer.h"
 
 /* CHANGE THIS TO YOUR OWN UNIQUE VALUE.  The MAC number should be
@@ -30,22 +36,49 @@ void lightJsonCmd(WebServer &server, WebServer::ConnectionType type, char *url_t
     server.httpFail();
     return;
   }
+
+  /* the sensor doesn't change much in a second, so a browser asking
+   * again sooner than that is sent the same reading, straight out of
+   * the cache */
+  if (server.cachedResponse(1000))
+    return;
   
-  /* for a GET or HEAD, send the standard "it's all OK headers" */
-  server.httpSuccess("application/json");
+  /* for a GET or HEAD, send the standard "it's all OK headers".  We
+   * don't know how long the reading will be, so send it in chunks, which
+   * lets the browser keep its connection open for the next request. */
+  server.httpSuccess("application/json", NULL, WebServer::CHUNKED);
 
-  /* we don't output the body for a HEAD request */
+  /* we don't output the body for a HEAD request.  The JsonWriter puts
+   * in the quotes, colons and commas, and formats the reading straight
+   * into the output buffer. */
   if (type == WebServer::GET)
   {
-    server.print("{ \"light\": ");
-    server.print(analogRead(LIGHT_SENSOR_PIN));
-    server.print(" }");
+    P(lightName) = "light";
+    WebServer::JsonWriter json(server);
+    json.beginObject();
+    json.key(lightName);
+    json.value(analogRead(LIGHT_SENSOR_PIN));
+    json.endObject();
   }
 }
 
+/* This command is set as the handler for the "light" event stream.  The
+ * browser keeps the connection open, and loop() sends it a new reading
+ * as an event every so often. */
+void lightEventsCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  if (type == WebServer::POST)
+  {
+    server.httpFail();
+    return;
+  }
+
+  server.httpEventStream();
+}
+
 /* This command is set as the handler for GET on the default page.  It returns an HTML page
- * that has JavaScript to fetch the light reading over and over and adjust the background
- * color of the page. */
+ * that has JavaScript to listen for light readings and adjust the background color of the
+ * page. */
 void defaultCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
 {
   if (type == WebServer::POST)
@@ -65,18 +98,17 @@ void defaultCmd(WebServer &server, WebServer::ConnectionType type, char *url_tai
       "<html><head>"
         "<script type=\"text/javascript\" src=\"http://ajax.googleapis.com/ajax/libs/jquery/1.3/jquery.min.js\"></script>"
         "<script>\n"
-        "function updateBackground() {\n"
-        "$.getJSON('light.json', function(json) {\n" 
-          "var grey = Math.floor(json.light / 4);\n"
-          "$('body').css('background-color', 'rgb(' + grey + ',' + grey + ',' + grey + ')');\n"
-          "setTimeout(function(){updateBackground();}, 200); })}\n"
-        "$(window).load(function(){ updateBackground();});\n"
+        "$(window).load(function() {\n"
+        "var source = new EventSource('light');\n"
+        "source.onmessage = function(event) {\n"
+          "var grey = Math.floor(event.data / 4);\n"
+          "$('body').css('background-color', 'rgb(' + grey + ',' + grey + ',' + grey + ')'); }});\n"
         "</script>"
       "</head>"
       "<body>"
-        "<p>This page is checking the light sensor on the Danger Shield five times a second and pulling down a JSON file "
-        "with the new value.  This is used to alter the page background color, with darker light readings making the "
-        " background darker.</p>"
+        "<p>This page gets a reading of the light sensor on the Danger Shield five times a second, sent down a "
+        "connection the page keeps open.  This is used to alter the page background color, with darker light "
+        "readings making the background darker.</p>"
         "<p><a href=\"light.json\">A link to the JSON file.</a></p>"
       "</body></html>";
     server.printP(defaultPage);
@@ -91,6 +123,14 @@ void setup()
   /* register our default command and feed command */
   webserver.setDefaultCommand(&defaultCmd);
   webserver.addCommand("light.json", lightJsonCmd);
+  webserver.addCommand("light", lightEventsCmd);
+
+  /* keep recent light.json answers, headers and all */
+  static char cache[256];
+  webserver.setCache(cache, sizeof(cache));
+
+  /* let browsers reuse their connection */
+  webserver.setKeepAlive();
 
   /* start the server to wait for connections */
   webserver.begin();
@@ -98,6 +138,19 @@ void setup()
 
 void loop()
 {
+  static unsigned long lastReading;
+
   // process incoming connections one at a time forever
   webserver.processConnection();
+
+  /* send the pages that are listening a new reading five times a second */
+  if (millis() - lastReading >= 200)
+  {
+    lastReading = millis();
+    if (webserver.beginEvent())
+    {
+      webserver.print(analogRead(LIGHT_SENSOR_PIN));
+      webserver.endEvent();
+    }
+  }
 }
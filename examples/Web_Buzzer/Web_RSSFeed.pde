@@ -40,8 +40,10 @@ void rssFeedCmd(WebServer &server, WebServer::ConnectionType type, char *url_tai
     return;
   }
   
-  /* for a GET or HEAD, send the standard "it's all OK headers" */
-  server.httpSuccess("application/rss+xml; charset=utf-8");
+  /* for a GET or HEAD, send the standard "it's all OK headers".  We
+   * don't know how long the feed will be, so send it in chunks, which
+   * lets the browser keep its connection open for the next request. */
+  server.httpSuccess("application/rss+xml; charset=utf-8", NULL, WebServer::CHUNKED);
 
   /* we don't output the body for a HEAD request */
   if (type == WebServer::GET)
@@ -106,6 +108,9 @@ void setup()
   webserver.setDefaultCommand(&defaultCmd);
   webserver.addCommand("rss.xml", rssFeedCmd);
 
+  /* let browsers reuse their connection */
+  webserver.setKeepAlive();
+
   /* start the server to wait for connections */
   webserver.begin();
 }
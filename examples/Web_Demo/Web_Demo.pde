@@ -76,6 +76,21 @@ void jsonCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail,
   server << " }";
 }
 
+// each analog pin is shown with a template: the text is sent straight
+// from program memory and analogField fills in the placeholders
+P(analogText) = "Analog {{pin}}: {{value}}<br/>";
+P(analogNames) = "pin value";
+WebServer::Template analogRow;
+
+void analogField(WebServer &server, uint8_t name, void *context)
+{
+  int pin = *(int *)context;
+  if (name == 0)
+    server << pin;
+  else
+    server << analogRead(pin);
+}
+
 void outputPins(WebServer &server, WebServer::ConnectionType type, bool addControls = false)
 {
   P(htmlHead) =
@@ -121,10 +136,7 @@ void outputPins(WebServer &server, WebServer::ConnectionType type, bool addContr
 
   server << "</p><h1>Analog Pins</h1><p>";
   for (i = 0; i <= 5; ++i)
-  {
-    int val = analogRead(i);
-    server << "Analog " << i << ": " << val << "<br/>";
-  }
+    server.renderTemplate(&analogRow, &analogField, &i);
 
   server << "</p>";
 
@@ -172,6 +184,8 @@ void setup()
   Ethernet.begin(mac, ip);
   webserver.begin();
 
+  webserver.compileTemplate(&analogRow, analogText, analogNames);
+
   webserver.setDefaultCommand(&defaultCmd);
   webserver.addCommand("json", &jsonCmd);
   webserver.addCommand("form", &formCmd);
@@ -0,0 +1,325 @@
+#!/usr/bin/env python3
+"""footprint.py - how much flash and RAM a Webduino server takes
+
+Builds a small sketch around each of a few WebServerT configurations,
+using every feature the configuration has, and reports the flash and
+static RAM it adds to an empty sketch built the same way, and the size
+of the server object itself, which is most of the RAM:
+
+    python3 tools/footprint.py [options] [NAME=SIZES[,FEATURE...]...]
+
+SIZES are the commands, URL buffer, input buffer and output buffer
+sizes, and the FEATUREs are any of routes, assets, events, websockets
+and cache, or all or none:
+
+    python3 tools/footprint.py small=4,24,16,64,routes
+
+Without any, a set covering the usual trade-offs is reported, followed
+by what leaving each feature out of a server with all the others
+saves.  A feature that's left out takes none of the server's or its
+connections' RAM, so its row should show the server shrinking by the
+feature's members.
+
+By default the sketches are built for this computer, with the
+stand-ins in bench/host, which is enough to compare configurations.
+For a board's real figures, build with its compiler, flags and include
+paths instead:
+
+    python3 tools/footprint.py --cxx avr-g++ --size avr-size --nm avr-nm \\
+        --cflags "-Os -mmcu=atmega328p -DARDUINO=22 -I$CORE -I$ETHERNET"
+
+Stack use isn't counted; processConnection() takes URL_SIZE bytes of
+it when called without a buffer.
+"""
+
+import argparse
+import os
+import shlex
+import subprocess
+import sys
+import tempfile
+
+TOP = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# WEBDUINO_FEATURE_... in WebServer.h
+FEATURES = {
+    'routes': 0x01,
+    'assets': 0x02,
+    'events': 0x04,
+    'websockets': 0x08,
+    'cache': 0x10,
+}
+ALL = 0xff
+
+# WEBDUINO_COMMANDS_COUNT, WEBDUINO_URL_BUFFER_SIZE,
+# WEBDUINO_INPUT_BUFFER_SIZE and WEBDUINO_OUTPUT_BUFFER_SIZE
+DEFAULT_SIZES = (8, 32, 32, 64)
+
+# name, sizes and features of the configurations reported by default
+CONFIGS = [
+    ('WebServer', None, 0),
+    ('none', DEFAULT_SIZES, 0),
+    ('routes', DEFAULT_SIZES, FEATURES['routes']),
+    ('assets', DEFAULT_SIZES, FEATURES['assets']),
+    ('events', DEFAULT_SIZES, FEATURES['events']),
+    ('websockets', DEFAULT_SIZES, FEATURES['websockets']),
+    ('cache', DEFAULT_SIZES, FEATURES['cache']),
+    ('tiny', (2, 24, 16, 32), 0),
+    ('large', (16, 128, 256, 1460), ALL),
+]
+
+# the server each feature is left out of for the savings reported
+FEATURE_SIZES = DEFAULT_SIZES
+
+EMPTY_SKETCH = '''\
+#include "Ethernet.h"
+
+void setup()
+{
+}
+
+void loop()
+{
+}
+'''
+
+
+def sketch(sizes, features):
+    """A sketch that uses every feature it's given."""
+    def has(name):
+        return features & FEATURES[name]
+
+    if sizes is None:
+        server = 'WebServer'
+    else:
+        server = 'WebServerT<%d, %d, %d, %d, 0x%02x>' % (sizes + (features,))
+
+    lines = ['#include "Ethernet.h"',
+             '#include "WebServer.h"',
+             '',
+             'typedef %s Web;' % server,
+             'Web webserver("", 80);',
+             '',
+             'static void pageCmd(Web &server, Web::ConnectionType type,',
+             '                    char *url_tail, bool tail_complete)',
+             '{']
+    if has('cache'):
+        lines += ['  if (server.cachedResponse(1000))',
+                  '    return;']
+    lines += ['  server.httpSuccess();',
+              '  if (type == Web::GET)',
+              '    server.print("hello");',
+              '}',
+              '']
+    if has('events'):
+        lines += ['static void eventsCmd(Web &server,',
+                  '                      Web::ConnectionType type,',
+                  '                      char *url_tail, bool tail_complete)',
+                  '{',
+                  '  server.httpEventStream();',
+                  '}',
+                  '']
+    if has('websockets'):
+        lines += ['static void echoCmd(Web &server, Web::SocketEvent event,',
+                  '                    const char *data, size_t length)',
+                  '{',
+                  '  if (event == Web::SOCKET_TEXT && server.beginMessage())',
+                  '  {',
+                  '    server.write((const uint8_t *)data, length);',
+                  '    server.endMessage();',
+                  '  }',
+                  '}',
+                  '',
+                  'static void socketCmd(Web &server,',
+                  '                      Web::ConnectionType type,',
+                  '                      char *url_tail, bool tail_complete)',
+                  '{',
+                  '  server.httpWebSocket(&echoCmd);',
+                  '}',
+                  '']
+    if has('routes'):
+        lines += ['P(pagePath) = "page";',
+                  'static const Web::Route routes[] PROGMEM =',
+                  '{',
+                  '  { pagePath, Web::ROUTE_GET, &pageCmd },',
+                  '};',
+                  '']
+    if has('assets'):
+        lines += ['P(textPath) = "hello.txt";',
+                  'P(textType) = "text/plain";',
+                  'P(textEtag) = "hello-1";',
+                  'P(textData) = "hello";',
+                  'static const Web::Asset assets[] PROGMEM =',
+                  '{',
+                  '  { textPath, textType, textEtag, textData, 5 },',
+                  '};',
+                  '']
+    if has('cache'):
+        lines += ['static char cache[128];',
+                  '']
+
+    lines += ['void setup()',
+              '{',
+              '  static uint8_t mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };',
+              '  static uint8_t ip[] = { 192, 168, 1, 210 };',
+              '  Ethernet.begin(mac, ip);',
+              '  webserver.setDefaultCommand(&pageCmd);',
+              '  webserver.addCommand("index.html", &pageCmd);']
+    if has('events'):
+        lines += ['  webserver.addCommand("events", &eventsCmd);']
+    if has('websockets'):
+        lines += ['  webserver.addCommand("socket", &socketCmd);',
+                  '  webserver.enableWebSockets();']
+    if has('routes'):
+        lines += ['  webserver.setRoutes(routes, SIZE(routes));']
+    if has('assets'):
+        lines += ['  webserver.setAssets(assets, SIZE(assets));']
+    if has('cache'):
+        lines += ['  webserver.setCache(cache, sizeof(cache));']
+    lines += ['  webserver.begin();',
+              '}',
+              '',
+              'void loop()',
+              '{',
+              '  webserver.processConnection();']
+    if has('events'):
+        lines += ['  webserver.sendEvent("tick");']
+    if has('websockets'):
+        lines += ['  webserver.sendMessage("tick");']
+    lines += ['}', '']
+    return '\n'.join(lines)
+
+
+def build(source, args, workdir, name):
+    """Compile source and return (flash, ram, server) for it, server
+    being the size of the webserver object or None."""
+    cpp = os.path.join(workdir, name + '.cpp')
+    obj = os.path.join(workdir, name + '.o')
+    with open(cpp, 'w') as f:
+        f.write(source)
+
+    command = ([args.cxx] + shlex.split(args.cflags) +
+               ['-I', os.path.join(TOP, 'webduino'), '-c', cpp, '-o', obj])
+    result = subprocess.run(command, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stdout)
+        raise SystemExit('%s: failed to build %s' % (sys.argv[0], name))
+
+    # Berkeley format: text data bss dec hex filename.  Initialised
+    # data takes room in flash for its initial values as well as RAM.
+    output = subprocess.check_output([args.size, obj],
+                                     universal_newlines=True)
+    text, data, bss = [int(field) for field in
+                       output.splitlines()[1].split()[:3]]
+
+    server = None
+    output = subprocess.check_output([args.nm, '-S', obj],
+                                     universal_newlines=True)
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[3] == 'webserver':
+            server = int(fields[1], 16)
+    return text + data, data + bss, server
+
+
+def parse_config(spec):
+    """NAME=SIZES[,FEATURE...] as (name, sizes, features)."""
+    name, sep, rest = spec.partition('=')
+    fields = rest.split(',')
+    if not sep or len(fields) < 4:
+        raise argparse.ArgumentTypeError(
+            'expected NAME=COMMANDS,URL,INPUT,OUTPUT[,FEATURE...]: %s' % spec)
+    try:
+        sizes = tuple(int(field, 0) for field in fields[:4])
+    except ValueError:
+        raise argparse.ArgumentTypeError('bad size in %s' % spec)
+
+    features = 0
+    for feature in fields[4:]:
+        if feature == 'all':
+            features = ALL
+        elif feature == 'none':
+            features = 0
+        elif feature in FEATURES:
+            features |= FEATURES[feature]
+        else:
+            raise argparse.ArgumentTypeError(
+                'unknown feature %s, not one of %s' %
+                (feature, ', '.join(sorted(FEATURES))))
+    return name, sizes, features
+
+
+def report_features(args, workdir, base):
+    """Print what leaving out each feature saves, as the flash, RAM and
+    server size of the server with all the features, then without
+    that one, the flash and RAM less base's."""
+    def measure(features, name):
+        flash, ram, server = build(sketch(FEATURE_SIZES, features), args,
+                                   workdir, name)
+        return flash - base[0], ram - base[1], server
+
+    full = measure(ALL, 'all')
+    print()
+    print('%-12s %17s %17s %17s  %s' %
+          ('without', 'flash', 'RAM', 'server',
+           '%d, %d, %d, %d' % FEATURE_SIZES))
+    for feature in sorted(FEATURES):
+        without = measure(ALL & ~FEATURES[feature], 'no' + feature)
+        columns = []
+        for before, after in zip(full, without):
+            if before is None or after is None:
+                columns.append('%17s' % '?')
+            else:
+                columns.append('%6d -> %6d' % (before, after))
+        print('%-12s %s' % (feature, ' '.join(columns)))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Report the flash and RAM Webduino servers take.')
+    parser.add_argument('configs', nargs='*', type=parse_config,
+                        metavar='NAME=SIZES[,FEATURE...]',
+                        help='configurations to report (default a few)')
+    parser.add_argument('--cxx', default='g++',
+                        help='compiler (default g++)')
+    # without RTTI, as on the boards, or each class the server derives
+    # from would add type information
+    parser.add_argument('--cflags',
+                        default='-Os -std=gnu++98 -fno-rtti -I ' +
+                        os.path.join(TOP, 'bench', 'host'),
+                        help='compiler flags (default for this computer, '
+                        'with the stand-ins in bench/host)')
+    parser.add_argument('--size', default='size',
+                        help='size program (default size)')
+    parser.add_argument('--nm', default='nm', help='nm program (default nm)')
+    args = parser.parse_args()
+
+    configs = args.configs or CONFIGS
+    workdir = tempfile.mkdtemp(prefix='footprint')
+    try:
+        base_flash, base_ram, _ = build(EMPTY_SKETCH, args, workdir, 'empty')
+        print('%-12s %8s %8s %8s  %s' %
+              ('config', 'flash', 'RAM', 'server', 'sizes, features'))
+        for i, (name, sizes, features) in enumerate(configs):
+            flash, ram, server = build(sketch(sizes, features), args,
+                                       workdir, 'config%d' % i)
+            described = ('defaults' if sizes is None else
+                         '%d, %d, %d, %d' % sizes)
+            names = [feature for feature in sorted(FEATURES)
+                     if features & FEATURES[feature]]
+            print('%-12s %8d %8d %8s  %s; %s' %
+                  (name, flash - base_flash, ram - base_ram,
+                   '?' if server is None else server, described,
+                   ' '.join(names) or 'no features'))
+
+        if not args.configs:
+            report_features(args, workdir, (base_flash, base_ram))
+    finally:
+        for entry in os.listdir(workdir):
+            os.remove(os.path.join(workdir, entry))
+        os.rmdir(workdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""pack_assets.py - turn a directory of web files into Webduino assets
+
+Writes a C++ header with each file under DIR stored in program memory,
+gzip compressed where that makes it smaller, and a table of
+WebServer::Asset entries for WebServer::setAssets():
+
+    python3 tools/pack_assets.py [--plain] [--name NAME] DIR > assets.h
+
+and in the sketch, which needs the assets feature
+
+    #define WEBDUINO_FEATURES WEBDUINO_FEATURE_ASSETS
+    #include "assets.h"
+    ...
+    webserver.setAssets(NAME, SIZE(NAME));
+
+Each file is served at its path relative to DIR.  The ETag is taken
+from a hash of the file, so it changes whenever the file does.
+
+Compressed files are only sent to browsers that accept gzip; others
+get "406 Not Acceptable".  --plain stores an uncompressed copy of each
+file as well for those browsers, at the cost of the extra flash.
+Files that gzip doesn't make smaller (images, mostly) are always
+stored as they are.
+"""
+
+import argparse
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+# MIME types by file extension
+TYPES = {
+    '.css': 'text/css',
+    '.gif': 'image/gif',
+    '.htm': 'text/html; charset=utf-8',
+    '.html': 'text/html; charset=utf-8',
+    '.ico': 'image/x-icon',
+    '.jpeg': 'image/jpeg',
+    '.jpg': 'image/jpeg',
+    '.js': 'application/javascript',
+    '.json': 'application/json',
+    '.png': 'image/png',
+    '.svg': 'image/svg+xml',
+    '.txt': 'text/plain',
+    '.xml': 'text/xml',
+}
+DEFAULT_TYPE = 'application/octet-stream'
+
+# Asset::length is a uint16_t
+MAX_LENGTH = 0xffff
+
+
+def c_name(path):
+    """An identifier made from a file's path."""
+    name = re.sub(r'[^A-Za-z0-9]', '_', path)
+    if name[0].isdigit():
+        name = '_' + name
+    return 'asset_' + name
+
+
+def c_bytes(data):
+    """The bytes of data as the body of a C array initialiser."""
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append('  ' + ', '.join('0x%02x' % b for b in data[i:i + 16]))
+    return ',\n'.join(lines)
+
+
+def c_string(text):
+    return '"' + text.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def find_files(top):
+    """Paths of the files under top, relative to it with "/" between
+    directories, sorted the way strcmp() would sort them."""
+    paths = []
+    for root, dirs, files in os.walk(top):
+        for f in files:
+            full = os.path.join(root, f)
+            paths.append(os.path.relpath(full, top).replace(os.sep, '/'))
+    return sorted(paths, key=lambda p: p.encode('utf-8'))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Make a header of Webduino assets from a directory.')
+    parser.add_argument('dir', help='directory of files to serve')
+    parser.add_argument('--name', default='webAssets',
+                        help='name of the Asset table (default webAssets)')
+    parser.add_argument('--plain', action='store_true',
+                        help='keep uncompressed copies too')
+    args = parser.parse_args()
+
+    out = sys.stdout
+    out.write('// Generated by tools/pack_assets.py from %s; do not edit.\n\n'
+              % os.path.basename(os.path.normpath(args.dir)))
+    out.write('#include "WebServer.h"\n\n')
+
+    entries = []
+    for path in find_files(args.dir):
+        with open(os.path.join(args.dir, path), 'rb') as f:
+            data = f.read()
+        packed = gzip.compress(data, 9, mtime=0)
+        if len(packed) >= len(data):
+            packed = None
+        plain = data if packed is None or args.plain else None
+        for blob in (plain, packed):
+            if blob is not None and len(blob) > MAX_LENGTH:
+                sys.exit('%s: too big for an asset' % path)
+
+        name = c_name(path)
+        mime = TYPES.get(os.path.splitext(path)[1].lower(), DEFAULT_TYPE)
+        etag = hashlib.sha1(data).hexdigest()[:12]
+
+        out.write('// %s: %d bytes' % (path, len(data)))
+        if packed is not None:
+            out.write(', %d gzipped' % len(packed))
+        out.write('\n')
+        out.write('P(%s_path) = %s;\n' % (name, c_string(path)))
+        out.write('P(%s_type) = %s;\n' % (name, c_string(mime)))
+        out.write('P(%s_etag) = "%s";\n' % (name, etag))
+        if plain is not None:
+            out.write('P(%s_data) = {\n%s\n};\n' % (name, c_bytes(plain)))
+        if packed is not None:
+            out.write('P(%s_gzip) = {\n%s\n};\n' % (name, c_bytes(packed)))
+        out.write('\n')
+
+        entry = '  { %s_path, %s_type, %s_etag,\n' % (name, name, name)
+        if plain is not None:
+            entry += '    %s_data, sizeof(%s_data),\n' % (name, name)
+        else:
+            entry += '    NULL, 0,\n'
+        if packed is not None:
+            entry += '    %s_gzip, sizeof(%s_gzip) }' % (name, name)
+        else:
+            entry += '    NULL, 0 }'
+        entries.append(entry)
+
+    out.write('static const WebServer::Asset %s[] PROGMEM =\n{\n' % args.name)
+    out.write(',\n'.join(entries))
+    out.write('\n};\n')
+
+
+if __name__ == '__main__':
+    main()
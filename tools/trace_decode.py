@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""trace_decode.py - turn Webduino trace events into request timelines
+
+A sketch built with WEBDUINO_TRACE writes its trace events as lines of
+the form "~ TIME EVENT SOCKET ARG" in hexadecimal, to the serial port
+through setTraceOutput() or at WEBDUINO_TRACE_URL.  Save them, mixed
+in with anything else the sketch printed if need be, and run
+
+    python3 tools/trace_decode.py [--events] [FILE...]
+
+to see each request from the moment its first byte was noticed to the
+moment the connection was closed or left open, with the time since the
+start of the request against every step:
+
+    socket 1, request 1 on the connection
+           0us  accepted
+         412us  request line read: GET
+        1208us  headers read, Content-Length 0
+        1240us  answered by command 2
+        3876us  handler finished, 486 bytes
+        4020us  done, connection closed
+
+--events lists the events one per line instead.  FILE defaults to
+standard input.
+"""
+
+import argparse
+import fileinput
+import re
+import sys
+
+# WEBDUINO_PHASE_... and WEBDUINO_TRACE_... in WebServer.h
+ACCEPT = 0
+REQUEST_DONE = 1
+HEADERS_DONE = 2
+HANDLER_START = 3
+HANDLER_DONE = 4
+STOP = 5
+TIMEOUT = 6
+HANGUP = 7
+LOST = 0xff
+
+# WebServer::ConnectionType
+METHODS = ['invalid', 'GET', 'HEAD', 'POST', 'PUT']
+
+# WebServer::ParseState, as where a request had got to or what a
+# connection was left doing
+STATES = ['closed', 'kept open for the next request', 'reading the URL',
+          'reading the HTTP version', 'reading the headers',
+          'reading the headers', 'reading the headers',
+          'reading the headers', 'streaming events', 'a WebSocket']
+
+# what answered a request, from a HANDLER_START event's argument
+ANSWERS = {
+    0xc000: 'the default command',
+    0xc001: 'the failure command',
+    0xc002: 'robots.txt',
+    0xc003: 'the status page',
+    0xc004: 'the trace page',
+}
+
+EVENT_LINE = re.compile(r'~ ([0-9A-Fa-f]+) ([0-9A-Fa-f]+) ([0-9A-Fa-f]+) '
+                        r'([0-9A-Fa-f]+)')
+
+
+def state_name(state):
+    if state < len(STATES):
+        return STATES[state]
+    return 'state %d' % state
+
+
+def answered_by(arg):
+    if arg in ANSWERS:
+        return ANSWERS[arg]
+    kind = ('command', 'route', 'asset')[arg >> 14]
+    return '%s %d' % (kind, arg & 0x3fff)
+
+
+def describe(event, arg):
+    """What an event says, in words."""
+    if event == ACCEPT:
+        return 'accepted'
+    if event == REQUEST_DONE:
+        method = METHODS[arg] if arg < len(METHODS) else str(arg)
+        return 'request line read: %s' % method
+    if event == HEADERS_DONE:
+        return 'headers read, Content-Length %d' % arg
+    if event == HANDLER_START:
+        return 'answered by %s' % answered_by(arg)
+    if event == HANDLER_DONE:
+        return 'handler finished, %d bytes' % arg
+    if event == STOP:
+        return 'done, connection %s' % state_name(arg)
+    if event == TIMEOUT:
+        return 'timed out %s' % state_name(arg)
+    if event == HANGUP:
+        return 'browser hung up %s' % state_name(arg)
+    if event == LOST:
+        return '%d events lost' % arg
+    return 'event %d (%d)' % (event, arg)
+
+
+def read_events(lines):
+    """(time, event, socket, arg) for each event line in lines."""
+    for line in lines:
+        match = EVENT_LINE.search(line)
+        if match:
+            yield tuple(int(field, 16) for field in match.groups())
+
+
+def elapsed(start, time):
+    # micros() wraps every 71 minutes or so
+    return (time - start) & 0xffffffff
+
+
+class Request:
+    def __init__(self, sock, time):
+        self.sock = sock
+        self.start = time
+        self.number = None
+        self.steps = []
+
+    def add(self, time, event, arg):
+        if event == ACCEPT:
+            self.number = arg + 1
+        self.steps.append((elapsed(self.start, time), describe(event, arg)))
+
+    def write(self, out):
+        if self.number is None:
+            out.write('socket %d, a request already under way\n' % self.sock)
+        else:
+            out.write('socket %d, request %d on the connection\n'
+                      % (self.sock, self.number))
+        for offset, text in self.steps:
+            out.write('  %10dus  %s\n' % (offset, text))
+        out.write('\n')
+
+
+def timelines(events, out):
+    """Group events by socket into requests, and write each one out
+    once it's over."""
+    requests = {}
+    for time, event, sock, arg in events:
+        if event == LOST:
+            out.write('--- %s ---\n\n' % describe(event, arg))
+            continue
+        request = requests.get(sock)
+        if event == ACCEPT and request is not None:
+            request.write(out)
+            request = None
+        if request is None:
+            request = requests[sock] = Request(sock, time)
+        request.add(time, event, arg)
+        if event in (STOP, TIMEOUT, HANGUP):
+            request.write(out)
+            del requests[sock]
+
+    for sock in sorted(requests):
+        requests[sock].write(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Decode Webduino trace events into timelines.')
+    parser.add_argument('files', nargs='*',
+                        help='saved trace output (default standard input)')
+    parser.add_argument('--events', action='store_true',
+                        help='list the events instead of grouping them')
+    args = parser.parse_args()
+
+    events = read_events(fileinput.input(args.files))
+    if args.events:
+        for time, event, sock, arg in events:
+            sys.stdout.write('%10d  socket %d  %s\n'
+                             % (time, sock, describe(event, arg)))
+    else:
+        timelines(events, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
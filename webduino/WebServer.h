@@ -45,15 +45,179 @@
 #define CRLF "\r\n"
 
 // If processConnection is called without a buffer, it allocates one
-// of 32 bytes
+// the size of the URL buffers below, 32 bytes unless set otherwise
 #define WEBDUINO_DEFAULT_REQUEST_LENGTH 32
 
+// Most commands registered with addCommand.  Larger sketches should use
+// a route table in program memory instead, see setRoutes().
+#ifndef WEBDUINO_COMMANDS_COUNT
+#define WEBDUINO_COMMANDS_COUNT 8
+#endif
+
+// poll() keeps the URL of each connection it's reading a request from
+// in a buffer of this size, one per socket
+#ifndef WEBDUINO_URL_BUFFER_SIZE
+#define WEBDUINO_URL_BUFFER_SIZE WEBDUINO_DEFAULT_REQUEST_LENGTH
+#endif
+
+// Most request headers that can be registered with captureHeader
+#ifndef WEBDUINO_CAPTURE_COUNT
+#define WEBDUINO_CAPTURE_COUNT 6
+#endif
+
+// Most parameters URLParams::parse() will index in one URL
+#ifndef WEBDUINO_URL_PARAMS_COUNT
+#define WEBDUINO_URL_PARAMS_COUNT 8
+#endif
+
+// Longest header line of a multipart/form-data part passed to a
+// PartCommand, see readMultipart(); longer ones are cut short
+#ifndef WEBDUINO_PART_HEADER_SIZE
+#define WEBDUINO_PART_HEADER_SIZE 80
+#endif
+
+// Most {{name}} placeholders in one template, see compileTemplate()
+#ifndef WEBDUINO_TEMPLATE_SLOTS
+#define WEBDUINO_TEMPLATE_SLOTS 8
+#endif
+
+// Room for the If-None-Match header of a request for an asset, see
+// setAssets()
+#ifndef WEBDUINO_ETAG_BUFFER_SIZE
+#define WEBDUINO_ETAG_BUFFER_SIZE 24
+#endif
+
+// Cache-Control header sent with assets.  With the default, browsers
+// keep their copy but check it's still current each time, which costs
+// a request and a "304 Not Modified" answer without the asset.  Sketches
+// that change an asset's URL whenever its content changes can use a
+// long "max-age=86400" instead to skip even that.
+#ifndef WEBDUINO_ASSET_CACHE_CONTROL
+#define WEBDUINO_ASSET_CACHE_CONTROL "no-cache"
+#endif
+
+// Features a WebServerT can be built without, to save the flash and
+// RAM they take, or'ed together as its FEATURES parameter.  A feature
+// that's left out takes no room in the server or its connections, and
+// calling it is a compile error.
+#define WEBDUINO_FEATURE_ROUTES     0x01  // setRoutes()
+#define WEBDUINO_FEATURE_ASSETS     0x02  // setAssets()
+#define WEBDUINO_FEATURE_EVENTS     0x04  // httpEventStream()
+#define WEBDUINO_FEATURE_WEBSOCKETS 0x08  // httpWebSocket()
+#define WEBDUINO_FEATURE_CACHE      0x10  // setCache()
+
+// the features WebServer has, none unless set otherwise, so a sketch
+// only pays for the ones it uses.  One that sends event streams has
+// this before including WebServer.h, with any others or'ed in:
+//
+//   #define WEBDUINO_FEATURES WEBDUINO_FEATURE_EVENTS
+#ifndef WEBDUINO_FEATURES
+#define WEBDUINO_FEATURES 0
+#endif
+
+// Requests a server reads at once, each in a connection of its own
+// with a URL buffer in it.  A browser that connects while they're all
+// busy waits in the chip until one is free, and one that's only being
+// kept open for a browser's next request, or hasn't had anything sent
+// on it yet, is closed to make room.  Event streams and WebSockets get
+// connections besides these, up to MAX_SOCK_NUM connections in all.
+#ifndef WEBDUINO_CONNECTIONS
+#define WEBDUINO_CONNECTIONS 1
+#endif
+
+// Most browsers subscribed to event streams at once, see
+// httpEventStream().  Each keeps one of the chip's sockets for as long
+// as it stays subscribed.
+#ifndef WEBDUINO_EVENT_STREAMS
+#define WEBDUINO_EVENT_STREAMS 2
+#endif
+
+// Most WebSockets open at once, see httpWebSocket().  Like event
+// streams, each keeps one of the chip's sockets.  A WebSocket's frame
+// headers are collected in its connection's URL buffer, so
+// WEBDUINO_URL_BUFFER_SIZE, or WebServerT's URL_SIZE, must be at least
+// 14, or a server with WebSockets won't compile.
+#ifndef WEBDUINO_WEBSOCKETS
+#define WEBDUINO_WEBSOCKETS 2
+#endif
+
+// An event stream that has been quiet for this long is sent a comment
+// line, and a WebSocket a ping, so proxies don't drop them and a
+// browser that has gone away is noticed.
+#ifndef WEBDUINO_EVENT_HEARTBEAT_IN_MS
+#define WEBDUINO_EVENT_HEARTBEAT_IN_MS 15000
+#endif
+
+// How many bytes can be written to a socket without waiting for the
+// browser to take what was sent before.  Events skip browsers that
+// aren't keeping up rather than hold loop() up for them.
+#ifndef WEBDUINO_SOCK_TX_FREE
+#include <utility/w5100.h>
+#define WEBDUINO_SOCK_TX_FREE(sock) W5100.getTXFreeSize(sock)
+#endif
+
+// ...and the most there ever can be, the chip's transmit buffer for
+// each socket
+#ifndef WEBDUINO_SOCK_TX_SIZE
+#define WEBDUINO_SOCK_TX_SIZE 2048
+#endif
+
 // How long to wait before considering a connection as dead when
 // reading the HTTP request.  Used to avoid DOS attacks.
 #ifndef WEBDUINO_READ_TIMEOUT_IN_MS
 #define WEBDUINO_READ_TIMEOUT_IN_MS 1000
 #endif
 
+// How long a browser has to send the whole request line and headers,
+// however steadily the bytes trickle in.  One that takes longer is
+// answered "408 Request Timeout" and dropped.
+#ifndef WEBDUINO_REQUEST_TIMEOUT_IN_MS
+#define WEBDUINO_REQUEST_TIMEOUT_IN_MS 5000
+#endif
+
+// How long a browser then has to send the request's body, while a
+// command reads it.  One that takes longer is dropped, and answered
+// "408 Request Timeout" if the command hadn't started its response.
+#ifndef WEBDUINO_BODY_TIMEOUT_IN_MS
+#define WEBDUINO_BODY_TIMEOUT_IN_MS WEBDUINO_REQUEST_TIMEOUT_IN_MS
+#endif
+
+// The largest Content-Length accepted.  A request claiming more, or
+// whose Content-Length can't be read, is answered "400 Bad Request"
+// and its connection closed, as there's no telling where its content
+// ends and the next request starts.
+#ifndef WEBDUINO_CONTENT_LENGTH_MAX
+#define WEBDUINO_CONTENT_LENGTH_MAX 999999999L
+#endif
+
+// Output is collected in a buffer of this many bytes and handed to
+// the Ethernet library in one piece when it fills, when the response
+// is finished or when flush() is called.  Each hand-off becomes at
+// least one packet on the wire, so larger values give fewer, fuller
+// packets.  Boards with RAM to spare can set this as high as the TCP
+// segment size (1460 bytes) before including WebServer.h.
+#ifndef WEBDUINO_OUTPUT_BUFFER_SIZE
+#define WEBDUINO_OUTPUT_BUFFER_SIZE 64
+#endif
+
+// Incoming data is pulled from the Ethernet library in bulk into a
+// buffer of this many bytes.  read(), push() and expect() work on this
+// buffer, so it also limits how long a string expect() can look for.
+#ifndef WEBDUINO_INPUT_BUFFER_SIZE
+#define WEBDUINO_INPUT_BUFFER_SIZE 32
+#endif
+
+// Defaults for setKeepAlive(): how long an idle persistent connection
+// is held open waiting for its next request, and how many requests
+// are answered on one connection before it's closed.
+#ifndef WEBDUINO_KEEP_ALIVE_TIMEOUT_IN_MS
+#define WEBDUINO_KEEP_ALIVE_TIMEOUT_IN_MS 5000
+#endif
+
+#ifndef WEBDUINO_KEEP_ALIVE_MAX_REQUESTS
+#define WEBDUINO_KEEP_ALIVE_MAX_REQUESTS 20
+#endif
+
 #ifndef WEBDUINO_FAIL_MESSAGE
 #define WEBDUINO_FAIL_MESSAGE "<h1>EPIC FAIL</h1>"
 #endif
@@ -68,12 +232,79 @@
 #include <HardwareSerial.h>
 #endif
 
+// Define WEBDUINO_METRICS as the number of commands to keep request
+// counters and latency histograms for, see routeStats(), in addition to
+// the failure and default commands and the built-in responses.  They
+// cost about 60 bytes of RAM each, so they're off unless asked for.
+#ifndef WEBDUINO_METRICS
+#define WEBDUINO_METRICS 0
+#endif
+
+// Define WEBDUINO_STATUS_URL as, say, "/status" as well to have the
+// counters served as plain text at that URL, like /robots.txt.
+
+// Define WEBDUINO_TRACE as a number of events to have the server note
+// what it's doing, and when, in a ring of that many 8 byte records as
+// it goes, see setTraceOutput().  Unlike WEBDUINO_SERIAL_DEBUGGING this
+// is quick enough not to change the timing being looked at.
+// tools/trace_decode.py turns the events into a timeline of each
+// request.
+#ifndef WEBDUINO_TRACE
+#define WEBDUINO_TRACE 0
+#endif
+
+// Define WEBDUINO_TRACE_URL as, say, "/trace" as well to have the
+// events waiting in the ring served at that URL.
+
+// Define WEBDUINO_PHASE_HOOK(phase) before including WebServer.h to
+// be called as processConnection moves through each request.  The
+// host benchmark in bench/ uses it to time the individual steps.
+#ifndef WEBDUINO_PHASE_HOOK
+#define WEBDUINO_PHASE_HOOK(phase)
+#endif
+
+// values passed to WEBDUINO_PHASE_HOOK
+#define WEBDUINO_PHASE_ACCEPT        0  // client socket picked up
+#define WEBDUINO_PHASE_REQUEST_DONE  1  // getRequest finished
+#define WEBDUINO_PHASE_HEADERS_DONE  2  // processHeaders finished
+#define WEBDUINO_PHASE_HANDLER_START 3  // about to call a command
+#define WEBDUINO_PHASE_HANDLER_DONE  4  // command returned
+#define WEBDUINO_PHASE_STOP          5  // connection closed
+
+// WEBDUINO_TRACE events are the phases above and these
+#define WEBDUINO_TRACE_TIMEOUT       6  // browser stopped sending
+#define WEBDUINO_TRACE_HANGUP        7  // browser hung up part way
+#define WEBDUINO_TRACE_LOST       0xff  // events overwritten unread
+
+// the argument of a WEBDUINO_PHASE_HANDLER_START event says what
+// answered the request
+#define WEBDUINO_TRACE_COMMAND  0x0000  // or'ed with its addCommand() index
+#define WEBDUINO_TRACE_ROUTE    0x4000  // ...its setRoutes() index
+#define WEBDUINO_TRACE_ASSET    0x8000  // ...its setAssets() index
+#define WEBDUINO_TRACE_DEFAULT  0xc000
+#define WEBDUINO_TRACE_FAILURE  0xc001
+#define WEBDUINO_TRACE_ROBOTS   0xc002
+#define WEBDUINO_TRACE_STATUS   0xc003
+#define WEBDUINO_TRACE_DUMP     0xc004  // WEBDUINO_TRACE_URL
+
+// Wiznet socket states, as returned by Client::status()
+#define WEBDUINO_SOCK_CLOSED      0x00
+#define WEBDUINO_SOCK_LISTEN      0x14
+#define WEBDUINO_SOCK_ESTABLISHED 0x17
+#define WEBDUINO_SOCK_CLOSE_WAIT  0x1C
+
 // declared in wiring.h
 extern "C" unsigned long millis(void);
+extern "C" unsigned long micros(void);
 
 // declare a static string
 #define P(name)   static const prog_uchar name[] PROGMEM
 
+// read a pointer stored in program memory
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(addr) ((void *)pgm_read_word(addr))
+#endif
+
 // returns the number of elements in the array
 #define SIZE(array) (sizeof(array) / sizeof(*array))
 
@@ -92,11 +323,308 @@ typedef enum URLPARAM_RESULT { URLPARAM_OK,
                                URLPARAM_EOS         // No params left
 };
 
-class WebServer: public Print
+// for defining WebServerT's members
+#define WEBDUINO_TEMPLATE \
+  template <uint8_t COMMANDS, size_t URL_SIZE, size_t INPUT_SIZE, \
+            size_t OUTPUT_SIZE, uint8_t FEATURES, uint8_t CONNECTIONS>
+#define WEBDUINO_SERVER \
+  WebServerT<COMMANDS, URL_SIZE, INPUT_SIZE, OUTPUT_SIZE, FEATURES, \
+             CONNECTIONS>
+
+// whether this WebServerT has WEBDUINO_FEATURE_<feature>.  It's a
+// constant, so the code for a feature that's left out is dropped.
+#define WEBDUINO_HAS(feature) ((FEATURES & WEBDUINO_FEATURE_##feature) != 0)
+// for the calls that turn a feature on: a sketch using a feature its
+// server leaves out fails to compile here, WebduinoRequire<false>
+// having no definition
+#define WEBDUINO_REQUIRE(feature) \
+  ((void)sizeof(WebduinoRequire<WEBDUINO_HAS(feature)>))
+// event streams and WebSockets both send to sockets left open
+#define WEBDUINO_FEATURE_BROADCAST \
+  (WEBDUINO_FEATURE_EVENTS | WEBDUINO_FEATURE_WEBSOCKETS)
+
+template <bool ON> struct WebduinoRequire;
+template <> struct WebduinoRequire<true> {};
+
+// the kinds of request a command can be answering, which WebServerT
+// inherits, so they're WebServer::GET and so on
+struct WebduinoRequestTypes
+{
+  enum ConnectionType { INVALID, GET, HEAD, POST, PUT };
+};
+
+// one entry in a route table, WebServerT::Route
+template <class Server>
+struct WebduinoRoute
+{
+  const prog_uchar *path;       // URL after the prefix and "/", not ""
+  uint8_t flags;                // ROUTE_ values or'ed together
+  typename Server::Command *cmd;
+};
+
+// a file kept in program memory, WebServerT::Asset
+struct WebduinoAsset
+{
+  const prog_uchar *path;         // URL after the prefix and "/"
+  const prog_uchar *contentType;  // such as "image/png"
+  const prog_uchar *etag;         // changes whenever data does
+  const prog_uchar *data;         // NULL if there's only gzipData
+  uint16_t length;
+  const prog_uchar *gzipData;     // the same gzip compressed, or NULL
+  uint16_t gzipLength;
+};
+
+// What a WebServerT, and each of its connections, keeps for the
+// features it can be built without.  It inherits these, and each has
+// a second version for a server without the feature whose members
+// are static: code using them still compiles, then goes with the
+// feature, and the members take no RAM at all.  (That version is a
+// partial specialization, which is what lets its static members be
+// defined here, hence the extra parameter on some.)
+
+// setRoutes()
+template <bool ON, class Route>
+struct WebduinoRouteState
+{
+  WebduinoRouteState() : m_routes(NULL), m_routeCount(0) {}
+  const Route *m_routes;
+  uint8_t m_routeCount;
+};
+
+template <class Route>
+struct WebduinoRouteState<false, Route>
+{
+  static const Route *m_routes;
+  static uint8_t m_routeCount;
+};
+
+template <class Route>
+const Route *WebduinoRouteState<false, Route>::m_routes;
+template <class Route>
+uint8_t WebduinoRouteState<false, Route>::m_routeCount;
+
+// setAssets()
+template <bool ON, class Asset>
+struct WebduinoAssetState
+{
+  WebduinoAssetState() : m_assets(NULL), m_assetCount(0)
+  {
+    m_ifNoneMatch[0] = 0;
+  }
+  const Asset *m_assets;
+  uint8_t m_assetCount;
+  char m_ifNoneMatch[WEBDUINO_ETAG_BUFFER_SIZE];
+};
+
+template <class Asset>
+struct WebduinoAssetState<false, Asset>
+{
+  static const Asset *m_assets;
+  static uint8_t m_assetCount;
+  static char m_ifNoneMatch[WEBDUINO_ETAG_BUFFER_SIZE];
+};
+
+template <class Asset>
+const Asset *WebduinoAssetState<false, Asset>::m_assets;
+template <class Asset>
+uint8_t WebduinoAssetState<false, Asset>::m_assetCount;
+template <class Asset>
+char WebduinoAssetState<false, Asset>::m_ifNoneMatch[WEBDUINO_ETAG_BUFFER_SIZE];
+
+// Between beginEvent() and endEvent(), or beginMessage() and
+// endMessage(), m_buffer is flushed to each socket in
+// m_broadcastSocks (a bit per socket) instead of m_client.  A
+// WebSocket message leaves room for a frame header at the start of
+// m_buffer, and m_frameOp is the FIN bit and opcode of the next
+// frame.  m_switchState is a ParseState to leave the connection in
+// after the response, instead of reading another request, or
+// PS_CLOSED.
+template <bool ON, class T = void>
+struct WebduinoBroadcastState
+{
+  WebduinoBroadcastState() :
+    m_broadcast(false), m_broadcastSocks(0), m_framed(false),
+    m_switchState(0) {}         // PS_CLOSED
+  bool m_broadcast;
+  bool m_broadcastChunked;      // m_chunked of the interrupted response
+  uint8_t m_broadcastSocks;
+  bool m_framed;
+  uint8_t m_frameOp;
+  uint8_t m_switchState;
+};
+
+template <class T>
+struct WebduinoBroadcastState<false, T>
+{
+  static bool m_broadcast;
+  static bool m_broadcastChunked;
+  static uint8_t m_broadcastSocks;
+  static bool m_framed;
+  static uint8_t m_frameOp;
+  static uint8_t m_switchState;
+};
+
+template <class T> bool WebduinoBroadcastState<false, T>::m_broadcast;
+template <class T> bool WebduinoBroadcastState<false, T>::m_broadcastChunked;
+template <class T> uint8_t WebduinoBroadcastState<false, T>::m_broadcastSocks;
+template <class T> bool WebduinoBroadcastState<false, T>::m_framed;
+template <class T> uint8_t WebduinoBroadcastState<false, T>::m_frameOp;
+template <class T> uint8_t WebduinoBroadcastState<false, T>::m_switchState;
+
+// httpWebSocket()
+template <bool ON, class T = void>
+struct WebduinoSocketState
+{
+  WebduinoSocketState() : m_droppedConns(0), m_socketCall(false)
+  {
+    m_socketKey[0] = 0;
+  }
+  uint8_t m_droppedConns;       // WebSockets closed for want of room,
+                                // a bit per connection
+  bool m_socketCall;            // a SocketCommand is running
+  char m_socketKey[26];         // Sec-WebSocket-Key, see enableWebSockets()
+};
+
+template <class T>
+struct WebduinoSocketState<false, T>
+{
+  static uint8_t m_droppedConns;
+  static bool m_socketCall;
+  static char m_socketKey[26];
+};
+
+template <class T> uint8_t WebduinoSocketState<false, T>::m_droppedConns;
+template <class T> bool WebduinoSocketState<false, T>::m_socketCall;
+template <class T> char WebduinoSocketState<false, T>::m_socketKey[26];
+
+// setCache().  The response cache is a list of entries, oldest
+// first, each a CacheEntry, the URL tail and then the response, in
+// m_cache up to m_cacheFill.  A response being kept is added after
+// them, up to m_cacheEnd.
+template <bool ON, class Command>
+struct WebduinoCacheState
+{
+  WebduinoCacheState() :
+    m_cache(NULL), m_cacheSize(0), m_cacheFill(0), m_cacheEnd(0),
+    m_caching(false), m_command(NULL) {}
+  uint8_t *m_cache;
+  size_t m_cacheSize;
+  size_t m_cacheFill;
+  size_t m_cacheEnd;
+  bool m_caching;               // keeping the response being sent
+  Command *m_command;           // command running, and its URL tail
+  const char *m_commandTail;
+};
+
+template <class Command>
+struct WebduinoCacheState<false, Command>
+{
+  static uint8_t *m_cache;
+  static size_t m_cacheSize;
+  static size_t m_cacheFill;
+  static size_t m_cacheEnd;
+  static bool m_caching;
+  static Command *m_command;
+  static const char *m_commandTail;
+};
+
+template <class Command>
+uint8_t *WebduinoCacheState<false, Command>::m_cache;
+template <class Command>
+size_t WebduinoCacheState<false, Command>::m_cacheSize;
+template <class Command>
+size_t WebduinoCacheState<false, Command>::m_cacheFill;
+template <class Command>
+size_t WebduinoCacheState<false, Command>::m_cacheEnd;
+template <class Command>
+bool WebduinoCacheState<false, Command>::m_caching;
+template <class Command>
+Command *WebduinoCacheState<false, Command>::m_command;
+template <class Command>
+const char *WebduinoCacheState<false, Command>::m_commandTail;
+
+// a connection that's an event stream
+template <bool ON, class T = void>
+struct WebduinoEventConnection
+{
+  uint8_t channel;              // events it gets, once it's PS_EVENTS
+};
+
+template <class T>
+struct WebduinoEventConnection<false, T>
+{
+  static uint8_t channel;
+};
+
+template <class T> uint8_t WebduinoEventConnection<false, T>::channel;
+
+// an open WebSocket, whose frame headers are read into urlBuffer
+template <bool ON, class SocketCommand>
+struct WebduinoSocketConnection
+{
+  SocketCommand *socketCmd;
+  uint8_t frameFill;            // bytes of the frame header read so far
+  uint8_t frameOp;              // FIN bit and opcode of the frame
+  uint8_t messageOp;            // opcode of the message it's part of
+  long frameLeft;               // bytes of the frame still to come
+};
+
+template <class SocketCommand>
+struct WebduinoSocketConnection<false, SocketCommand>
+{
+  static SocketCommand *socketCmd;
+  static uint8_t frameFill;
+  static uint8_t frameOp;
+  static uint8_t messageOp;
+  static long frameLeft;
+};
+
+template <class SocketCommand>
+SocketCommand *WebduinoSocketConnection<false, SocketCommand>::socketCmd;
+template <class SocketCommand>
+uint8_t WebduinoSocketConnection<false, SocketCommand>::frameFill;
+template <class SocketCommand>
+uint8_t WebduinoSocketConnection<false, SocketCommand>::frameOp;
+template <class SocketCommand>
+uint8_t WebduinoSocketConnection<false, SocketCommand>::messageOp;
+template <class SocketCommand>
+long WebduinoSocketConnection<false, SocketCommand>::frameLeft;
+
+// The server, sized for one sketch.  Its parameters are how many
+// commands addCommand() takes, the size of each connection's URL
+// buffer, of the input and output buffers, which of the
+// WEBDUINO_FEATURE_s it's built with, and how many requests it reads
+// at once.  They default to the macros above, which is what WebServer
+// uses:
+//
+//   // two commands, 24 character URLs, 16 bytes of input, a packet
+//   // of output, and nothing but commands
+//   WebServerT<2, 24, 16, 256, 0> webserver("", 80);
+//
+// Each server type is a separate copy of the code, so a sketch should
+// stick to one.  tools/footprint.py reports the RAM and flash a few of
+// them take.
+template <uint8_t COMMANDS = WEBDUINO_COMMANDS_COUNT,
+          size_t URL_SIZE = WEBDUINO_URL_BUFFER_SIZE,
+          size_t INPUT_SIZE = WEBDUINO_INPUT_BUFFER_SIZE,
+          size_t OUTPUT_SIZE = WEBDUINO_OUTPUT_BUFFER_SIZE,
+          uint8_t FEATURES = WEBDUINO_FEATURES,
+          uint8_t CONNECTIONS = WEBDUINO_CONNECTIONS>
+class WebServerT: public Print, public WebduinoRequestTypes,
+  private WebduinoRouteState<WEBDUINO_HAS(ROUTES),
+                             WebduinoRoute<WEBDUINO_SERVER> >,
+  private WebduinoAssetState<WEBDUINO_HAS(ASSETS), WebduinoAsset>,
+  private WebduinoBroadcastState<WEBDUINO_HAS(BROADCAST)>,
+  private WebduinoSocketState<WEBDUINO_HAS(WEBSOCKETS)>,
+  private WebduinoCacheState<WEBDUINO_HAS(CACHE),
+                             void (WEBDUINO_SERVER &,
+                                   WebduinoRequestTypes::ConnectionType,
+                                   char *, bool)>
 {
 public:
-  // passed to a command to indicate what kind of request was received
-  enum ConnectionType { INVALID, GET, HEAD, POST };
+  // WebduinoRequestTypes::ConnectionType, passed to a command to
+  // indicate what kind of request was received: INVALID, GET, HEAD,
+  // POST or PUT
 
   // any commands registered with the web server have to follow
   // this prototype.
@@ -104,11 +632,11 @@ public:
   //          the registered command table.
   // tail_complete is true if the complete URL fit in url_tail,  false if
   //          part of it was lost because the buffer was too small.
-  typedef void Command(WebServer &server, ConnectionType type,
+  typedef void Command(WebServerT &server, ConnectionType type,
                        char *url_tail, bool tail_complete);
 
   // constructor for webserver object
-  WebServer(const char *urlPrefix = "/", int port = 80);
+  WebServerT(const char *urlPrefix = "/", int port = 80);
 
   // start listening for connections
   void begin();
@@ -124,14 +652,138 @@ public:
   // handler.  This version saves the "tail" of the URL in buff.
   void processConnection(char *buff, int *bufflen);
 
+  // a non-blocking alternative to processConnection.  Each call reads
+  // whatever request data has arrived on every open connection,
+  // remembering where it got to, and only runs a command once a
+  // request's line and headers are complete.  A slow browser therefore
+  // no longer holds up loop() or other browsers while it sends its
+  // request.  Commands that read POST data still wait for that data to
+  // arrive.  Use either poll() or processConnection() in a sketch, not
+  // both.
+  void poll();
+
   // set command that's run when you access the root of the server
   void setDefaultCommand(Command *cmd);
 
   // set command run for undefined pages
   void setFailureCommand(Command *cmd);
 
-  // add a new command to be run at the URL specified by verb
-  void addCommand(const char *verb, Command *cmd);
+  // add a new command to be run at the URL specified by verb.
+  // returns false if there are already COMMANDS commands.
+  bool addCommand(const char *verb, Command *cmd);
+
+  // one entry in a route table, see setRoutes(), and WebduinoRoute
+  // for its members
+  typedef WebduinoRoute<WebServerT> Route;
+
+  // Route::flags.  A route for GET also answers HEAD requests, and a
+  // route with no method flags answers every method.  A ROUTE_PREFIX
+  // route matches any URL that starts with its path, and its command
+  // gets the rest of the URL as url_tail.
+  enum { ROUTE_ANY = 0,
+         ROUTE_GET = 1 << GET,
+         ROUTE_HEAD = 1 << HEAD,
+         ROUTE_POST = 1 << POST,
+         ROUTE_PUT = 1 << PUT,
+         ROUTE_PREFIX = 0x80 };
+
+  // use a table of routes kept in program memory, looked up by binary
+  // search, so large numbers of URLs cost no RAM and little time:
+  //
+  //   P(jsonPath) = "data.json";
+  //   P(setPath) = "set";
+  //   static const WebServer::Route routes[] PROGMEM = {
+  //     { jsonPath, WebServer::ROUTE_GET, &jsonCmd },
+  //     { setPath, WebServer::ROUTE_GET, &showSettingsCmd },
+  //     { setPath, WebServer::ROUTE_POST, &saveSettingsCmd },
+  //   };
+  //   webserver.setRoutes(routes, SIZE(routes));
+  //
+  // The table must be sorted by path in strcmp() order, with entries
+  // for the same path next to each other.  It's searched before any
+  // commands added with addCommand.
+  void setRoutes(const Route *routes, uint8_t count);
+
+  // a file kept in program memory, such as an image or a style sheet,
+  // see setAssets(), and WebduinoAsset for its members
+  typedef WebduinoAsset Asset;
+
+  // serve a table of assets kept in program memory, sorted by path
+  // in strcmp() order like a route table:
+  //
+  //   P(ledPath) = "led.png";
+  //   P(pngType) = "image/png";
+  //   P(ledEtag) = "led-1";
+  //   P(ledData) = { 0x89, 0x50, 0x4e, 0x47, ... };
+  //   static const WebServer::Asset assets[] PROGMEM = {
+  //     { ledPath, pngType, ledEtag, ledData, sizeof(ledData) },
+  //   };
+  //   webserver.setAssets(assets, SIZE(assets));
+  //
+  // GET and HEAD requests for an asset are answered with its length,
+  // ETag and a Cache-Control header, so the connection can be kept
+  // open and browsers can cache it.  When the browser already has the
+  // current version (its If-None-Match header names the ETag) the
+  // answer is "304 Not Modified" without the data.  Assets are
+  // searched before routes and commands.
+  //
+  // An asset with gzipData is sent compressed, with "Content-Encoding:
+  // gzip", to browsers whose Accept-Encoding header allows it.  Others
+  // get data or, if the asset has none, "406 Not Acceptable".
+  // tools/pack_assets.py makes a header of compressed assets from a
+  // directory of files.
+  //
+  // The If-None-Match header is read with captureHeader, so this takes
+  // one of the WEBDUINO_CAPTURE_COUNT slots.  Returns false if there
+  // was none left; assets are still served, just never as 304.
+  bool setAssets(const Asset *assets, uint8_t count);
+
+  // send an asset from program memory as setAssets would, for commands
+  // that choose between assets themselves
+  void sendAsset(const Asset *asset);
+
+  // allow browsers to send more requests over the same connection
+  // (HTTP/1.1 persistent connections).  A connection is closed once
+  // it has been idle for idleTimeout milliseconds or has carried
+  // maxRequests requests, and the least recently used idle connection
+  // is closed early if the Ethernet chip runs out of sockets.  Only
+  // responses that give their length (see httpSuccess) can be sent
+  // this way; anything else still closes the connection afterwards.
+  // Requests a browser sends without waiting for the responses before
+  // them (pipelining) are answered in turn.  Pass an idleTimeout of 0
+  // to turn this off again.
+  void setKeepAlive(unsigned long idleTimeout =
+                      WEBDUINO_KEEP_ALIVE_TIMEOUT_IN_MS,
+                    uint8_t maxRequests = WEBDUINO_KEEP_ALIVE_MAX_REQUESTS);
+
+  // called over and over while the server waits for a browser to send
+  // more of a request or to make room for more of a response, so the
+  // rest of the sketch, a control loop say, keeps running.  It mustn't
+  // read or send anything through the server, or call
+  // processConnection() or poll().
+  typedef void IdleCommand(WebServerT &server);
+
+  // set the command called while the server waits, NULL for none
+  void setIdleCommand(IdleCommand *cmd);
+
+  // copy the value of the request header called name into buffer,
+  // which has room for length characters including the NUL, for every
+  // request from now on.  name is in program memory and lower case:
+  //
+  //   static char host[32];
+  //   P(hostHeader) = "host";
+  //   webserver.captureHeader(hostHeader, host, sizeof(host));
+  //
+  // Commands find the value of the request they're answering in
+  // buffer, or an empty string if the browser didn't send the header.
+  // Values that don't fit are cut short.  Headers nobody asked for are
+  // skipped over without being stored.  Returns false if there are
+  // already WEBDUINO_CAPTURE_COUNT headers registered.
+  //
+  // When poll() has several browsers sending requests at once, only
+  // one request at a time can be read into the buffers; the others
+  // wait until its command has run.
+  bool captureHeader(const prog_uchar *name, char *buffer, uint8_t length);
 
   // utility function to output CRLF pair
   void printCRLF();
@@ -143,6 +795,45 @@ public:
   // output raw data stored in program memory
   void writeP(const prog_uchar *data, size_t length);
 
+  // called by renderTemplate() for each placeholder in a template.
+  // name is the position of the placeholder's name in the list given
+  // to compileTemplate(), counting from 0, and context is whatever was
+  // passed to renderTemplate().
+  typedef void TemplateCommand(WebServerT &server, uint8_t name,
+                               void *context);
+
+  // A page kept in program memory with {{name}} placeholders in it,
+  // ready to be sent by renderTemplate().  Fill one in with
+  // compileTemplate().
+  struct Template
+  {
+    const prog_uchar *text;
+    uint16_t length;            // of text
+    uint8_t count;              // placeholders in text
+    struct Slot
+    {
+      uint16_t start;           // offset of the "{{"
+      uint16_t end;             // offset just after the "}}"
+      uint8_t name;
+    } slots[WEBDUINO_TEMPLATE_SLOTS];
+  };
+
+  // find the {{name}} placeholders in text, a string in program
+  // memory, and record where they are in tmpl.  names is a string in
+  // program memory listing the names the placeholders may use,
+  // separated by spaces, such as "led temp".  Returns false, leaving
+  // tmpl empty, if a placeholder isn't in names or isn't closed, or if
+  // there are more than WEBDUINO_TEMPLATE_SLOTS of them.  Do this once,
+  // in setup() or the first time the template is needed.
+  bool compileTemplate(Template *tmpl, const prog_uchar *text,
+                       const prog_uchar *names);
+
+  // output a compiled template, sending the text between placeholders
+  // straight from program memory and calling cmd to output each
+  // placeholder
+  void renderTemplate(const Template *tmpl, TemplateCommand *cmd,
+                      void *context = NULL);
+
   // output HTML for a radio button
   void radioButton(const char *name, const char *val,
                    const char *label, bool selected);
@@ -154,12 +845,14 @@ public:
   // returns next character or -1 if we're at end-of-stream
   int read();
 
-  // put a character that's been read back into the input pool
-  void push(int ch);
+  // put a character that's been read back into the input pool.
+  // returns false if there was no room left to store it.
+  bool push(int ch);
 
   // returns true if the string is next in the stream.  Doesn't
   // consume any character if false, so can be used to try out
-  // different expected values.
+  // different expected values.  The string can be at most INPUT_SIZE
+  // characters long.
   bool expect(const char *expectedStr);
 
   // returns true if a number, with possible whitespace in front, was
@@ -181,35 +874,543 @@ public:
   URLPARAM_RESULT nextURLparam(char **tail, char *name, int nameLen,
                                char *value, int valueLen);
 
+  // what readMultipart() is telling a PartCommand about
+  enum PartEvent
+  {
+    PART_HEADER,                // data is one header line of a part
+    PART_DATA,                  // data is the next piece of its body
+    PART_END                    // the part is over
+  };
+
+  // called by readMultipart() as it reads a multipart/form-data body.
+  // For PART_HEADER, data is NUL terminated.  Return false to stop
+  // reading.
+  typedef bool PartCommand(WebServerT &server, PartEvent event,
+                           const char *data, size_t length, void *context);
+
+  // Read a multipart/form-data POST body, as sent by forms with a file
+  // input, passing each part's headers and then its body to cmd a
+  // piece at a time as it arrives, so parts of any size can be handled.
+  // contentType is the request's Content-Type header, which the sketch
+  // can keep with captureHeader(), and holds the boundary between
+  // parts.  Returns true once the last part has been read, or false if
+  // contentType has no boundary, cmd returned false or the body ended
+  // early.
+  bool readMultipart(const char *contentType, PartCommand *cmd,
+                     void *context = NULL);
+
+  // called by readBody() with the next length bytes of the request
+  // body, which start offset bytes into it.  Return how many of them
+  // were dealt with: if that's fewer than length, the command is
+  // called again with the rest.  Return 0 while it can't take any,
+  // because an SD card is still busy, say, and the idle command (see
+  // setIdleCommand) runs before it's asked again; after
+  // WEBDUINO_READ_TIMEOUT_IN_MS of that readBody() gives up.  Return
+  // -1 to stop reading.
+  typedef int BodyCommand(WebServerT &server, const char *data,
+                          size_t length, long offset, void *context);
+
+  // what became of readBody()
+  enum BodyResult
+  {
+    BODY_COMPLETE,              // all of Content-Length was read
+    BODY_TRUNCATED,             // the browser stopped sending first
+    BODY_STOPPED                // the command returned -1, claimed
+                                // more than it was given or stayed
+                                // busy too long
+  };
+
+  // Pass the body of a POST or PUT request to cmd in bulk as it
+  // arrives, for uploads that aren't form parameters, such as a
+  // configuration file or new firmware.  Without a buffer, cmd gets
+  // each piece straight from the input buffer, up to INPUT_SIZE
+  // bytes at a time.  With one, the pieces are collected into it
+  // first, so each is size bytes long except the last.  No more than
+  // Content-Length bytes are read, and a browser that stops sending
+  // for WEBDUINO_READ_TIMEOUT_IN_MS is dropped.
+  BodyResult readBody(BodyCommand *cmd, void *context = NULL,
+                      char *buffer = NULL, size_t size = 0);
+
+  // the length of the request body given by its Content-Length
+  // header, or 0 if there wasn't one
+  long contentLength();
+
+  // copy the value of parameter param of a header such as
+  // Content-Type or Content-Disposition, as in
+  // 'form-data; name="file"; filename="a.txt"', into value.  Returns
+  // false if there's no such parameter or it didn't fit in valueLen.
+  bool getHeaderParam(const char *header, const char *param,
+                      char *value, int valueLen);
+
+  // The parameters of a URL, found all at once without copying them.
+  // A command can keep one on its stack:
+  //
+  //   WebServer::URLParams params;
+  //   params.parse(url_tail);
+  //   int level = params.getInt("level", 0);
+  //
+  // parse() decodes url_tail in place, so it can only be done once.
+  struct URLParams
+  {
+    uint8_t count;
+    struct Param
+    {
+      const char *name;         // NUL terminated, nameLen long
+      const char *value;        // NUL terminated, "" if there's no "="
+      int nameLen;
+      int valueLen;
+    } params[WEBDUINO_URL_PARAMS_COUNT];
+
+    // split tail into parameters, decoding "+" and "%xx" and ending
+    // each name and value with a NUL.  Returns false if there were
+    // more than WEBDUINO_URL_PARAMS_COUNT parameters, in which case the
+    // first ones are kept.
+    bool parse(char *tail);
+
+    // the value of the first parameter called name, or NULL if there
+    // isn't one
+    const char *get(const char *name) const;
+
+    // the value of the parameter called name as a decimal number, or
+    // otherwise if it's missing or isn't a number
+    int getInt(const char *name, int otherwise = 0) const;
+
+    // false if the parameter called name is "0", "false", "off" or
+    // "no", true if it's anything else (including empty, as in
+    // "?debug"), or otherwise if it's missing
+    bool getBool(const char *name, bool otherwise = false) const;
+  };
+
+  // Writes JSON into the response a piece at a time, putting the
+  // commas in, checking the nesting, formatting numbers straight into
+  // the output buffer and escaping strings:
+  //
+  //   P(lightName) = "light";
+  //   P(historyName) = "history";
+  //   WebServer::JsonWriter json(server);
+  //   json.beginObject();
+  //   json.key(lightName);
+  //   json.value(analogRead(3));
+  //   json.key(historyName);
+  //   json.beginArray();
+  //   for (uint8_t i = 0; i < count; ++i)
+  //     json.fixed(history[i], 1);
+  //   json.endArray();
+  //   json.endObject();
+  //
+  // gives {"light":512,"history":[21.5,21.7]}.  Objects and arrays
+  // nest up to 16 deep.
+  class JsonWriter
+  {
+  public:
+    JsonWriter(WebServerT &server);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    // the name of the next member of an object, in program memory,
+    // which is written as it is...
+    void key(const prog_uchar *name);
+    // ...or in RAM, which is escaped like a string value
+    void key(const char *name);
+
+    void value(int number);
+    void value(unsigned int number);
+    void value(long number);
+    void value(unsigned long number);
+    void value(bool b);
+    // a string, or null if str is NULL
+    void value(const char *str);
+    // a string in program memory
+    void valueP(const prog_uchar *str);
+    // number with a decimal point places digits from the right, so
+    // fixed(2315, 2) gives 23.15, for readings kept in hundredths and
+    // the like without floating point
+    void fixed(long number, uint8_t places);
+    void null();
+
+    // true once a whole value has been written, with everything that
+    // was opened closed again and nothing out of place
+    bool done() const;
+
+  private:
+    WebServerT &m_server;
+    uint8_t m_depth;
+    uint16_t m_objects;         // a bit per level, set for an object
+    bool m_comma;               // a value came before, so one's needed
+    bool m_key;                 // a key is waiting for its value
+    bool m_error;
+
+    bool next(bool isKey);
+    void open(uint8_t ch, bool object);
+    void close(uint8_t ch, bool object);
+    void write(bool comma, const char *text, size_t length);
+    void writeString(const char *str);
+  };
+
   // output headers and a message indicating a server error
   void httpFail();
 
+  // pass as the contentLength of httpSuccess to send a body whose
+  // length isn't known beforehand, see below
+  enum { CHUNKED = -2, MEASURE = -3 };
+
   // output standard headers indicating "200 Success".  You can change the
   // type of the data you're outputting or also add extra headers like
   // "Refresh: 1".  Extra headers should each be terminated with CRLF.
+  // If you know how many bytes of body will follow, pass it as
+  // contentLength so the connection can be kept open afterwards.
+  // Otherwise, passing CHUNKED sends everything printed afterwards in
+  // chunks, one per output buffer full, with the last one sent when
+  // the command returns, and lets the connection stay open just the
+  // same.  Browsers that only speak HTTP/1.0, or servers with
+  // persistent connections turned off, get the body as usual instead.
+  // A command whose output comes out the same every time can pass
+  // MEASURE instead: its output is counted without being sent, and
+  // then the command is run a second time to send it after an exact
+  // Content-Length.  Only GET requests are measured; HEAD and POST
+  // responses are sent as if CHUNKED had been passed.
   void httpSuccess(const char *contentType = "text/html; charset=utf-8",
-                   const char *extraHeaders = NULL);
+                   const char *extraHeaders = NULL,
+                   long contentLength = -1);
+
+  // like httpSuccess for a body of length bytes that the command can
+  // send any part of, such as a file or a log.  If the request's Range
+  // header asks for part of it, the answer is "206 Partial Content"
+  // with a Content-Range header, or "416 Range Not Satisfiable" if the
+  // part is past the end.  Either way, *offset and *count are set to
+  // the bytes of the body the command should then send, which are all
+  // of them for a plain "200 OK" and none for a 416.  One range is
+  // supported; a request for several gets the whole body.
+  void httpSuccessRange(const char *contentType, long length,
+                        long *offset, long *count,
+                        const char *extraHeaders = NULL);
 
   // used with POST to output a redirect to another URL.  This is
   // preferable to outputting HTML from a post because you can then
   // refresh the page without getting a "resubmit form" dialog.
   void httpSeeOther(const char *otherURL);
 
+  // give the server size bytes of RAM to keep recent responses in, see
+  // cachedResponse()
+  void setCache(char *buffer, size_t size);
+
+  // call at the start of a command whose GET responses stay the same
+  // for maxAge milliseconds, such as a reading that's polled by several
+  // browsers at once.  Returns true if a response the command sent for
+  // the same URL in that time was kept and has just been sent again in
+  // one piece, in which case the command should return straight away.
+  // Otherwise the command should carry on as usual, and its headers and
+  // body are kept for next time if they fit, the oldest responses
+  // making way for them.
+  bool cachedResponse(unsigned long maxAge);
+
+  // forget the responses kept for cmd, or every response if cmd is
+  // NULL, when what they show has changed
+  void invalidateCache(Command *cmd = NULL);
+
+  // answer with an event stream ("text/event-stream"), which is left
+  // open after the command returns so events can be sent to the browser
+  // from loop() with beginEvent() or sendEvent().  channel says which
+  // events it gets.  Returns false, having answered "503 Service
+  // Unavailable", when WEBDUINO_EVENT_STREAMS browsers are subscribed
+  // already.  A HEAD request just gets the headers.
+  bool httpEventStream(uint8_t channel = 0);
+
+  // start an event for every browser subscribed to channel.  Print the
+  // event's data, which mustn't contain newlines, then call endEvent().
+  // Browsers that haven't taken the last events yet are left out of
+  // this one rather than waited for.  Returns false, and nothing should
+  // be printed, if there's nobody to send it to.
+  bool beginEvent(const char *event = NULL, uint8_t channel = 0);
+  void endEvent();
+
+  // send an event whose data is a string
+  bool sendEvent(const char *data, const char *event = NULL,
+                 uint8_t channel = 0);
+
+  // how many browsers are subscribed to channel
+  uint8_t eventStreams(uint8_t channel = 0);
+
+  // what a SocketCommand is being told about a WebSocket
+  enum SocketEvent
+  {
+    SOCKET_OPEN,                // the browser has connected
+    SOCKET_TEXT,                // data is the next piece of a text message
+    SOCKET_BINARY,              // ...or of a binary message
+    SOCKET_END,                 // the message is over
+    SOCKET_CLOSE                // the WebSocket has closed
+  };
+
+  // called with what happens on a WebSocket opened by httpWebSocket().
+  // Each message arrives a piece at a time, however the browser split
+  // it into frames, with each piece no longer than INPUT_SIZE and
+  // SOCKET_END after the last.
+  // SOCKET_CLOSE comes when the browser closes the WebSocket or goes
+  // away, but not when one that couldn't keep up with messages is
+  // dropped.
+  typedef void SocketCommand(WebServerT &server, SocketEvent event,
+                             const char *data, size_t length);
+
+  // register the Sec-WebSocket-Key request header with captureHeader(),
+  // which httpWebSocket() needs.  Returns false if there's no room.
+  bool enableWebSockets();
+
+  // answer a WebSocket handshake with "101 Switching Protocols", after
+  // which the connection carries messages to and from cmd instead of
+  // requests, alongside the usual pages on other connections.  Returns
+  // false, having answered with an error, if the request isn't a
+  // WebSocket handshake we understand or WEBDUINO_WEBSOCKETS are open
+  // already.
+  bool httpWebSocket(SocketCommand *cmd);
+
+  // start a message to every WebSocket opened with cmd or, if cmd is
+  // NULL, to the one a SocketCommand has been called for.  Print the
+  // message, then call endMessage().  It goes a bufferful at a time,
+  // one frame each, and WebSockets that aren't keeping up are left out
+  // as with beginEvent().  Returns false, and nothing should be
+  // printed, if there's nobody to send it to.
+  bool beginMessage(SocketCommand *cmd = NULL, bool binary = false);
+  void endMessage();
+
+  // send a text message
+  bool sendMessage(const char *text, SocketCommand *cmd = NULL);
+
+#if WEBDUINO_METRICS
+  // counters kept for a command, see routeStats()
+  struct RouteStats
+  {
+    Command *cmd;               // NULL for the built-in responses
+    unsigned long requests;
+    unsigned long bytesIn;      // request line, headers and body read
+    unsigned long bytesOut;     // status line, headers and body sent
+    uint16_t timeouts;          // the browser stopped sending
+    uint16_t drops;             // the browser hung up part way through
+    uint16_t truncated;         // the URL didn't fit: tail_complete false
+    uint16_t overflows;         // readPOSTparam() had to cut a value short
+    // requests by micros() from the end of their headers to the end of
+    // the response: under 256us, 1ms, 4ms, 16ms, 64ms, 256ms, 1s, and
+    // the rest
+    unsigned long latency[8];
+  };
+
+  // routeStats() index of the counters for the failure command, which
+  // also get the timeouts and hang-ups of requests that never got as
+  // far as a command, the default command, robots.txt, assets and
+  // the status page, and the first of WEBDUINO_METRICS other commands,
+  // in the order they were first asked for.  Requests for commands
+  // after that aren't counted.
+  enum { STATS_FAILURE, STATS_DEFAULT, STATS_BUILTIN, STATS_COMMANDS };
+
+  // the counters at index, or NULL past the last one in use
+  const RouteStats *routeStats(uint8_t index);
+
+  // start counting again from zero
+  void resetStats();
+#endif
+
+#if WEBDUINO_TRACE
+  // have trace events written to out, Serial say, one at a time
+  // whenever poll() or processConnection() finds nothing to do.  Pass
+  // NULL to leave them in the ring.
+  void setTraceOutput(Print *out);
+
+  // write up to max of the events in the ring to out, oldest first, and
+  // take them out of the ring.  Each is a line of hexadecimal numbers:
+  // "~", micros(), the event, the socket and an argument.  Returns how
+  // many were written.
+  uint16_t dumpTrace(Print &out, uint16_t max = 0xffff);
+#endif
+
   // implementation of write used to implement Print interface
   virtual void write(uint8_t);
   virtual void write(const char *str);
   virtual void write(const uint8_t *buffer, size_t size);
   void write(const char *data, size_t length);
 
+  // send anything waiting in the output buffer to the client.  This
+  // is done automatically before the connection is closed.
+  void flush();
+
 private:
   Server m_server;
   Client m_client;
   const char *m_urlPrefix;
+  uint16_t m_port;
+
+  // where parseRequest() has got to in a request
+  enum ParseState { PS_CLOSED, PS_METHOD, PS_URL, PS_VERSION,
+                    PS_LINE_START, PS_NAME, PS_VALUE, PS_SKIP,
+                    PS_EVENTS,          // an event stream, not reading
+                    PS_WEBSOCKET };     // reading WebSocket frames
+
+  // the connections: CONNECTIONS reading requests, and one for each
+  // event stream and WebSocket there can be, as far as the chip's
+  // sockets go
+  enum { CONNECTION_COUNT = CONNECTIONS +
+         (WEBDUINO_HAS(EVENTS) ? WEBDUINO_EVENT_STREAMS : 0) +
+         (WEBDUINO_HAS(WEBSOCKETS) ? WEBDUINO_WEBSOCKETS : 0),
+         SLOTS = CONNECTION_COUNT < MAX_SOCK_NUM ?
+                 CONNECTION_COUNT : MAX_SOCK_NUM };
+
+  // what we know about a browser's connection.  It has socket sock
+  // until its state goes back to PS_CLOSED.  m_sock is the socket
+  // m_client is using, and m_conn its connection.
+  struct Connection:
+    WebduinoEventConnection<WEBDUINO_HAS(EVENTS)>,
+    WebduinoSocketConnection<WEBDUINO_HAS(WEBSOCKETS), SocketCommand>
+  {
+    uint8_t sock;
+    unsigned long lastActive;   // millis() when we last heard from it
+    unsigned long started;      // millis() when the request, then its
+                                // body, began
+    uint8_t requests;           // requests answered on this connection
+    bool idle;                  // kept open, waiting for next request
+
+    // state of the request being read
+    uint8_t state;              // a ParseState
+    uint8_t header;             // header whose value we're reading...
+    uint8_t capture;            // ...and registered header we're storing
+    uint8_t captureFill;        // characters of it stored so far
+    uint8_t which;              // table entry matched so far...
+    uint8_t matched;            // ...and how many characters of it
+    ConnectionType type;
+    bool keepAlive;
+    bool http11;
+    uint8_t encodings;          // WEBDUINO_ENCODING_... flags
+    uint8_t upgrade;            // WebSocket handshake headers seen
+    uint8_t body;               // WEBDUINO_BODY_... flags
+    long contentLength;
+    long rangeFirst;            // Range header, -1 if a part is missing
+    long rangeLast;
+    char *url;
+    char *urlEnd;
+    int urlSpace;               // room left in url, -1 once it overflowed
+    char urlBuffer[URL_SIZE];
+#if WEBDUINO_METRICS
+    unsigned long received;     // bytes of the request read so far
+#endif
+  } m_conns[SLOTS];
+  uint8_t m_sock;
+  Connection *m_conn;
+
+  // registered request headers.  The names are kept in their own
+  // array so they can be matched like our own header table.
+  const prog_uchar *m_captureNames[WEBDUINO_CAPTURE_COUNT];
+  struct HeaderCapture
+  {
+    char *buffer;
+    uint8_t length;
+  } m_captures[WEBDUINO_CAPTURE_COUNT];
+  uint8_t m_captureCount;
+  uint8_t m_captureSock;        // socket being read into them, or
+                                // MAX_SOCK_NUM if none
+
+  unsigned long m_keepAliveTimeout;
+  uint8_t m_keepAliveMax;
+  IdleCommand *m_idleCmd;
+
+  ConnectionType m_requestType;
+  bool m_keepAlive;     // this request may leave the connection open
+  bool m_persist;       // the response was sent with a known length
+                        // or in chunks
+  bool m_http11;        // the browser understands chunks
+
+  uint8_t m_buffer[OUTPUT_SIZE];
+  size_t m_bufFill;
+  // In a chunked response, m_buffer holds anything from before the
+  // body up to m_chunkStart, then room for the chunk's size line, then
+  // the chunk itself, which is kept short enough to leave room for the
+  // CRLF that ends it.
+  bool m_chunked;
+  size_t m_chunkStart;
+  size_t m_bufLimit;    // flush once m_bufFill reaches this
+  // A MEASURE response runs its command twice, first with the output
+  // counted and thrown away as it's flushed from m_buffer, then for
+  // real.  m_sent lets finishResponse() check the two agreed.
+  enum { MEASURE_OFF, MEASURE_COUNTING, MEASURE_COUNTED, MEASURE_SENDING };
+  uint8_t m_measure;
+  size_t m_measureStart;        // m_bufFill when counting started
+  long m_measured;
+  unsigned long m_sent;         // bytes handed to the Ethernet library
+  unsigned long m_measureEnd;   // m_sent once the body has gone
+  // the state of the features this server may be built without, see
+  // WebduinoRouteState and the rest
+  typedef WebduinoBroadcastState<WEBDUINO_HAS(BROADCAST)> BroadcastState;
+  using BroadcastState::m_broadcast;
+  using BroadcastState::m_broadcastChunked;
+  using BroadcastState::m_broadcastSocks;
+  using BroadcastState::m_framed;
+  using BroadcastState::m_frameOp;
+  using BroadcastState::m_switchState;
+  typedef WebduinoSocketState<WEBDUINO_HAS(WEBSOCKETS)> SocketState;
+  using SocketState::m_droppedConns;
+  using SocketState::m_socketCall;
+  using SocketState::m_socketKey;
+  typedef WebduinoCacheState<WEBDUINO_HAS(CACHE), Command> CacheState;
+  using CacheState::m_cache;
+  using CacheState::m_cacheSize;
+  using CacheState::m_cacheFill;
+  using CacheState::m_cacheEnd;
+  using CacheState::m_caching;
+  using CacheState::m_command;
+  using CacheState::m_commandTail;
+  typedef WebduinoRouteState<WEBDUINO_HAS(ROUTES), Route> RouteState;
+  using RouteState::m_routes;
+  using RouteState::m_routeCount;
+  typedef WebduinoAssetState<WEBDUINO_HAS(ASSETS), Asset> AssetState;
+  using AssetState::m_assets;
+  using AssetState::m_assetCount;
+  using AssetState::m_ifNoneMatch;
+
+  // a WebSocket's frame header is read into its connection's URL
+  // buffer, which must hold the longest, 14 bytes
+  typedef char CheckURLSize[(!WEBDUINO_HAS(WEBSOCKETS) || URL_SIZE >= 14) ?
+                            1 : -1];
+
+  // an entry in the response cache, see WebduinoCacheState
+  struct CacheEntry
+  {
+    Command *cmd;
+    unsigned long sent;         // millis() when it was sent
+    unsigned long maxAge;
+    size_t length;              // bytes of response after the tail
+    uint8_t tailLength;
+    uint8_t flags;              // WEBDUINO_CACHE_...
+  };
+
+#if WEBDUINO_TRACE
+  struct TraceEvent
+  {
+    unsigned long time;         // micros()
+    uint8_t event;              // WEBDUINO_PHASE_... or WEBDUINO_TRACE_...
+    uint8_t sock;
+    uint16_t arg;
+  } m_trace[WEBDUINO_TRACE];
+  uint16_t m_traceHead;         // where the next event goes
+  uint16_t m_traceCount;        // events not written out yet
+  uint16_t m_traceLost;         // events overwritten before they were
+  Print *m_traceOut;
+#endif
 
-  char m_pushback[32];
-  char m_pushbackDepth;
+#if WEBDUINO_METRICS
+  RouteStats m_stats[STATS_COMMANDS + WEBDUINO_METRICS];
+  RouteStats *m_routeStats;     // counters for the request being answered
+  uint8_t m_incidents;          // WEBDUINO_INCIDENT_... during it
+#endif
+
+  // unread input is m_rxBuffer[m_rxHead] up to m_rxBuffer[m_rxTail - 1]
+  uint8_t m_rxBuffer[INPUT_SIZE];
+  size_t m_rxHead;
+  size_t m_rxTail;
 
-  int m_contentLength;
+  long m_contentLength;         // POST content not read yet
+  long m_contentTotal;          // from the Content-Length header
+  unsigned long m_contentSent;  // m_sent when the headers were read
+  long m_rangeFirst;
+  long m_rangeLast;
   bool m_readingContent;
 
   Command *m_failureCmd;
@@ -217,388 +1418,3398 @@ private:
   struct CommandMap
   {
     const char *verb;
+    uint8_t verbLen;
     Command *cmd;
-  } m_commands[8];
-  char m_cmdCount;
+  } m_commands[COMMANDS];
+  uint8_t m_cmdCount;
+
+  bool m_acceptGzip;
 
   void reset();
-  void getRequest(WebServer::ConnectionType &type, char *request, int *length);
+  void scanSockets();
+  bool acceptClient();
+  void stopSocket(uint8_t sock);
+  Connection *connection(uint8_t sock);
+  void startRequest(Connection &conn, char *url, int length);
+  bool claimCaptures(uint8_t sock);
+  bool parseRequest(Connection &conn);
+  bool parseChar(Connection &conn, uint8_t ch);
+  void headerValueChar(Connection &conn, uint8_t ch);
+  void headerValueDone(Connection &conn);
+  void handleRequest(Connection &conn, bool complete);
+  void finishResponse();
+  bool nextRequest(Connection &conn);
+  uint8_t countSockets(uint8_t state);
+  void httpUnavailable();
+  void rejectContent(uint8_t body);
+  bool beginBroadcast(uint8_t socks, bool framed, uint8_t frameOp);
+  void endBroadcast();
+  void flushBroadcast();
+  void readWebSocket(Connection &conn);
+  void startFrame(Connection &conn);
+  void framePayload(Connection &conn, const char *data, size_t length);
+  void endFrame(Connection &conn);
+  void closeWebSocket(Connection &conn, uint16_t status);
+  void socketClosed(Connection &conn);
+  bool ponging(uint8_t sock);
+  void callSocket(Connection &conn, SocketEvent event, const char *data,
+                  size_t length);
+  uint8_t cacheFlags();
+  void cacheOutput(const uint8_t *data, size_t length);
+  void dropCacheEntry(size_t pos);
+  void finishCache();
+#if WEBDUINO_TRACE
+  void trace(uint8_t event, uint8_t sock, uint16_t arg);
+  void sendTrace(ConnectionType type);
+#endif
+#if WEBDUINO_METRICS
+  void countRequest(Connection &conn, unsigned long started,
+                    unsigned long sent, bool tail_complete);
+  void countIncident(uint8_t incident);
+  void sendStatus(ConnectionType type);
+#endif
+  size_t readAvailable();
+  size_t readContent(const char **data, size_t max = ~(size_t)0);
+  void openChunk();
+  void closeChunk();
+  bool fillBuffer(size_t want, bool request = false);
+  void sendTimeout();
+  void waitToSend(size_t length);
   bool dispatchCommand(ConnectionType requestType, char *verb,
                        bool tail_complete);
-  void processHeaders();
+  bool etagMatches(const prog_uchar *etag, const prog_uchar *suffix);
+
+  // how a response answers the request's Range header
+  enum RangeResult { RANGE_WHOLE, RANGE_PART, RANGE_UNSATISFIABLE };
+  RangeResult selectRange(long length, long *offset, long *count);
+  void printRangeStatus(RangeResult range, long count);
+  void printRangeHeaders(RangeResult range, long offset, long count,
+                         long length);
+  const Route *findRoute(ConnectionType requestType, const char *path,
+                         int len, int *matchedLen);
+  void runCommand(Command *cmd, ConnectionType requestType, char *tail,
+                  bool tail_complete);
   void outputCheckboxOrRadio(const char *element, const char *name,
                              const char *val, const char *label,
                              bool selected);
 
-  static void defaultFailCmd(WebServer &server, ConnectionType type,
+  static void defaultFailCmd(WebServerT &server, ConnectionType type,
                              char *url_tail, bool tail_complete);
+  static void formField(WebServerT &server, uint8_t name, void *context);
   void noRobots(ConnectionType type);
+  void printStatus(const prog_uchar *status, long contentLength);
 };
 
+// the server with the sizes and features set by the WEBDUINO_ macros
+typedef WebServerT<> WebServer;
+
 /********************************************************************
  * IMPLEMENTATION
  ********************************************************************/
 
-WebServer::WebServer(const char *urlPrefix, int port) :
+#if WEBDUINO_TRACE
+#define WEBDUINO_TRACE_EVENT(event, sock, arg) trace(event, sock, arg)
+
+// a count as an event's argument, which stops at 0xffff
+static uint16_t webduinoTraceCount(unsigned long count)
+{
+  return count > 0xffff ? 0xffff : count;
+}
+#else
+#define WEBDUINO_TRACE_EVENT(event, sock, arg)
+#endif
+
+WEBDUINO_TEMPLATE
+WEBDUINO_SERVER::WebServerT(const char *urlPrefix, int port) :
   m_server(port),
   m_client(255),
   m_urlPrefix(urlPrefix),
-  m_pushbackDepth(0),
+  m_port(port),
+  m_sock(0),
+  m_conn(m_conns),
+  m_captureCount(0),
+  m_captureSock(MAX_SOCK_NUM),
+  m_keepAliveTimeout(0),
+  m_keepAliveMax(0),
+  m_idleCmd(NULL),
+  m_bufFill(0),
+  m_chunked(false),
+  m_bufLimit(sizeof(m_buffer)),
+  m_measure(MEASURE_OFF),
+  m_sent(0),
+  m_rxHead(0),
+  m_rxTail(0),
   m_cmdCount(0),
   m_contentLength(0),
+  m_contentTotal(0),
+  m_contentSent(0),
   m_failureCmd(&defaultFailCmd),
   m_defaultCmd(&defaultFailCmd)
 {
+#if WEBDUINO_METRICS
+  memset(m_stats, 0, sizeof(m_stats));
+  m_routeStats = NULL;
+  m_incidents = 0;
+#endif
+#if WEBDUINO_TRACE
+  m_traceHead = 0;
+  m_traceCount = 0;
+  m_traceLost = 0;
+  m_traceOut = NULL;
+#endif
 }
 
-void WebServer::begin()
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::begin()
 {
+  memset(m_conns, 0, sizeof(m_conns));
   m_server.begin();
 }
 
-void WebServer::setDefaultCommand(Command *cmd)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::setKeepAlive(unsigned long idleTimeout,
+                                   uint8_t maxRequests)
 {
-  m_defaultCmd = cmd;
+  m_keepAliveTimeout = idleTimeout;
+  m_keepAliveMax = maxRequests;
 }
 
-void WebServer::setFailureCommand(Command *cmd)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::setIdleCommand(IdleCommand *cmd)
 {
-  m_failureCmd = cmd;
+  m_idleCmd = cmd;
 }
 
-void WebServer::addCommand(const char *verb, Command *cmd)
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::captureHeader(const prog_uchar *name, char *buffer,
+                                    uint8_t length)
 {
-  if (m_cmdCount < SIZE(m_commands))
-  {
-    m_commands[m_cmdCount].verb = verb;
-    m_commands[m_cmdCount++].cmd = cmd;
-  }
+  if (m_captureCount >= SIZE(m_captures) || length == 0)
+    return false;
+
+  buffer[0] = 0;
+  m_captureNames[m_captureCount] = name;
+  m_captures[m_captureCount].buffer = buffer;
+  m_captures[m_captureCount++].length = length;
+  return true;
 }
 
-void WebServer::write(uint8_t ch)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::setDefaultCommand(Command *cmd)
 {
-  m_client.write(ch);
+  m_defaultCmd = cmd;
 }
 
-void WebServer::write(const char *str)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::setFailureCommand(Command *cmd)
 {
-  m_client.write(str);
+  m_failureCmd = cmd;
 }
 
-void WebServer::write(const uint8_t *buffer, size_t size)
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::addCommand(const char *verb, Command *cmd)
 {
-  m_client.write(buffer, size);
+  if (m_cmdCount >= SIZE(m_commands))
+    return false;
+
+  m_commands[m_cmdCount].verb = verb;
+  m_commands[m_cmdCount].verbLen = strlen(verb);
+  m_commands[m_cmdCount++].cmd = cmd;
+  return true;
 }
 
-void WebServer::write(const char *buffer, size_t length)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::setRoutes(const Route *routes, uint8_t count)
 {
-  m_client.write((const uint8_t *)buffer, length);
+  WEBDUINO_REQUIRE(ROUTES);
+  m_routes = routes;
+  m_routeCount = count;
 }
 
-void WebServer::writeP(const prog_uchar *data, size_t length)
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::setAssets(const Asset *assets, uint8_t count)
 {
-  // copy data out of program memory into local storage, write out in
-  // chunks of 32 bytes to avoid extra short TCP/IP packets
-  uint8_t buffer[32];
-  size_t bufferEnd = 0;
+  P(ifNoneMatchHeader) = "if-none-match";
+
+  WEBDUINO_REQUIRE(ASSETS);
+  bool registered = m_assets != NULL ||
+    captureHeader(ifNoneMatchHeader, m_ifNoneMatch, sizeof(m_ifNoneMatch));
+  m_assets = assets;
+  m_assetCount = count;
+  return registered;
+}
 
-  while (length--)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::flush()
+{
+  if (WEBDUINO_HAS(BROADCAST) && m_broadcast)
   {
-    if (bufferEnd == 32)
-    {
-      m_client.write(buffer, 32);
-      bufferEnd = 0;
-    }
-
-    buffer[bufferEnd++] = pgm_read_byte(data++);
+    flushBroadcast();
+    return;
+  }
+  if (m_measure == MEASURE_COUNTING)
+  {
+    m_measured += m_bufFill - m_measureStart;
+    m_bufFill = m_measureStart;
+    return;
+  }
+  if (m_chunked)
+    closeChunk();
+  if (m_bufFill > 0)
+  {
+    waitToSend(m_bufFill);
+    m_client.write(m_buffer, m_bufFill);
+    if (WEBDUINO_HAS(CACHE) && m_caching)
+      cacheOutput(m_buffer, m_bufFill);
+    m_sent += m_bufFill;
+    m_bufFill = 0;
   }
+  if (m_chunked)
+    openChunk();
+}
 
-  if (bufferEnd > 0)
-    m_client.write(buffer, bufferEnd);
+// Chunk sizes are always written as four hex digits, which is allowed,
+// so the size line takes a fixed amount of room
+#define WEBDUINO_CHUNK_SIZE_LINE 6
+
+// Start a new chunk at the end of the output buffer.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::openChunk()
+{
+  m_chunkStart = m_bufFill;
+  m_bufFill += WEBDUINO_CHUNK_SIZE_LINE;
 }
 
-void WebServer::printP(const prog_uchar *str)
+// Fill in the size line of the chunk at the end of the output buffer
+// and end it with CRLF, or drop it if it's empty, which would mean
+// the end of the body.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::closeChunk()
 {
-  // copy data out of program memory into local storage, write out in
-  // chunks of 32 bytes to avoid extra short TCP/IP packets
-  uint8_t buffer[32];
-  size_t bufferEnd = 0;
-  
-  while (buffer[bufferEnd++] = pgm_read_byte(str++))
+  static const char hex[] = "0123456789abcdef";
+  size_t length = m_bufFill - m_chunkStart - WEBDUINO_CHUNK_SIZE_LINE;
+  if (length == 0)
   {
-    if (bufferEnd == 32)
-    {
-      m_client.write(buffer, 32);
-      bufferEnd = 0;
-    }
+    m_bufFill = m_chunkStart;
+    return;
   }
 
-  // write out everything left but trailing NUL
-  if (bufferEnd > 1)
-    m_client.write(buffer, bufferEnd - 1);
+  uint8_t *line = m_buffer + m_chunkStart;
+  line[0] = hex[(length >> 12) & 0xf];
+  line[1] = hex[(length >> 8) & 0xf];
+  line[2] = hex[(length >> 4) & 0xf];
+  line[3] = hex[length & 0xf];
+  line[4] = '\r';
+  line[5] = '\n';
+  m_buffer[m_bufFill++] = '\r';
+  m_buffer[m_bufFill++] = '\n';
 }
 
-void WebServer::printCRLF()
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::write(uint8_t ch)
 {
-  m_client.write((const uint8_t *)"\r\n", 2);
+  m_buffer[m_bufFill++] = ch;
+  if (m_bufFill >= m_bufLimit)
+    flush();
 }
 
-bool WebServer::dispatchCommand(ConnectionType requestType, char *verb,
-        bool tail_complete)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::write(const char *str)
 {
-  if ((verb[0] == 0) || ((verb[0] == '/') && (verb[1] == 0)))
+  write((const uint8_t *)str, strlen(str));
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::write(const uint8_t *buffer, size_t size)
+{
+  if (m_measure == MEASURE_COUNTING)
   {
-    m_defaultCmd(*this, requestType, verb, tail_complete);
-    return true;
+    m_measured += size;
+    return;
   }
-  // We now know that the URL contains at least one character.  And,
-  // if the first character is a slash,  there's more after it.
-  if (verb[0] == '/')
+
+  while (size > 0)
   {
-    char i;
-    char *qm_loc;
-    int verb_len;
-    int qm_offset;
-    // Skip over the leading "/",  because it makes the code more
-    // efficient and easier to understand.
-    verb++;
-    // Look for a "?" separating the filename part of the URL from the
-    // parameters.  If it's not there, compare to the whole URL.
-    qm_loc = strchr(verb, '?');
-    verb_len = (qm_loc == NULL) ? strlen(verb) : (qm_loc - verb);
-    qm_offset = (qm_loc == NULL) ? 0 : 1;
-    for (i = 0; i < m_cmdCount; ++i)
+    // blocks at least as big as the buffer don't need to be copied,
+    // the Ethernet library can send them straight from the caller
+    if (m_bufFill == 0 && size >= sizeof(m_buffer) && !m_chunked &&
+        !(WEBDUINO_HAS(BROADCAST) && m_broadcast))
     {
-      if ((verb_len == strlen(m_commands[i].verb))
-          && (strncmp(verb, m_commands[i].verb, verb_len) == 0))
-      {
-        // Skip over the "verb" part of the URL (and the question
-        // mark, if present) when passing it to the "action" routine
-        m_commands[i].cmd(*this, requestType,
-        verb + verb_len + qm_offset,
-        tail_complete);
-        return true;
-      }
+      waitToSend(size);
+      m_client.write(buffer, size);
+      if (WEBDUINO_HAS(CACHE) && m_caching)
+        cacheOutput(buffer, size);
+      m_sent += size;
+      return;
     }
+
+    size_t room = m_bufLimit - m_bufFill;
+    if (room > size)
+      room = size;
+    memcpy(m_buffer + m_bufFill, buffer, room);
+    m_bufFill += room;
+    buffer += room;
+    size -= room;
+
+    if (m_bufFill >= m_bufLimit)
+      flush();
   }
-  return false;
 }
 
-// processConnection with a default buffer
-void WebServer::processConnection()
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::write(const char *buffer, size_t length)
 {
-  char request[WEBDUINO_DEFAULT_REQUEST_LENGTH];
-  int  request_len = WEBDUINO_DEFAULT_REQUEST_LENGTH;
-  processConnection(request, &request_len);
+  write((const uint8_t *)buffer, length);
 }
 
-void WebServer::processConnection(char *buff, int *bufflen)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::writeP(const prog_uchar *data, size_t length)
 {
-  m_client = m_server.available();
-
-  if (m_client) {
-    m_readingContent = false;
-    buff[0] = 0;
-    ConnectionType requestType = INVALID;
-#if WEBDUINO_SERIAL_DEBUGGING > 1
-    Serial.println("*** checking request ***");
-#endif
-    getRequest(requestType, buff, bufflen);
-#if WEBDUINO_SERIAL_DEBUGGING > 1
-    Serial.print("*** requestType = ");
-    Serial.print((int)requestType);
-    Serial.println(", request = \"");
-    Serial.print(buff);
-    Serial.println("\" ***");
-#endif
-    processHeaders();
-#if WEBDUINO_SERIAL_DEBUGGING > 1
-    Serial.println("*** headers complete ***");
-#endif
-
-    int urlPrefixLen = strlen(m_urlPrefix);
-    if (strcmp(buff, "/robots.txt") == 0)
-    {
-      noRobots(requestType);
-    }
-    else if (requestType == INVALID ||
-             strncmp(buff, m_urlPrefix, urlPrefixLen) != 0 ||
-             !dispatchCommand(requestType, buff + urlPrefixLen,
-                              (*bufflen) >= 0))
-    {
-      m_failureCmd(*this, requestType, buff, (*bufflen) >= 0);
-    }
+  if (m_measure == MEASURE_COUNTING)
+  {
+    m_measured += length;
+    return;
+  }
 
-#if WEBDUINO_SERIAL_DEBUGGING > 1
-    Serial.println("*** stopping connection ***");
-#endif
-    m_client.stop();
+  // copy data out of program memory straight into the output buffer,
+  // as much as fits at a time
+  while (length > 0)
+  {
+    size_t room = m_bufLimit - m_bufFill;
+    if (room > length)
+      room = length;
+    memcpy_P(m_buffer + m_bufFill, data, room);
+    m_bufFill += room;
+    data += room;
+    length -= room;
+
+    if (m_bufFill >= m_bufLimit)
+      flush();
   }
 }
 
-void WebServer::httpFail()
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::printP(const prog_uchar *str)
 {
-  P(failMsg) =
-    "HTTP/1.0 400 Bad Request" CRLF
-    WEBDUINO_SERVER_HEADER
-    "Content-Type: text/html" CRLF
-    CRLF
-    WEBDUINO_FAIL_MESSAGE;
-
-  printP(failMsg);
+  // copy data out of program memory straight into the output buffer,
+  // stopping at the trailing NUL
+  uint8_t ch;
+  while ((ch = pgm_read_byte(str++)) != 0)
+  {
+    m_buffer[m_bufFill++] = ch;
+    if (m_bufFill >= m_bufLimit)
+      flush();
+  }
 }
 
-void WebServer::defaultFailCmd(WebServer &server,
-                               WebServer::ConnectionType type,
-                               char *url_tail,
-                               bool tail_complete)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::printCRLF()
 {
-  server.httpFail();
+  write((const uint8_t *)"\r\n", 2);
 }
 
-void WebServer::noRobots(ConnectionType type)
+// Compare a path in program memory with the first len characters of
+// path, returning less than, equal to or greater than zero like
+// strcmp().
+static int webduinoComparePath(const prog_uchar *routePath,
+                               const char *path, int len)
 {
-  httpSuccess("text/plain");
-  if (type != HEAD)
+  for (int i = 0; i < len; ++i)
   {
-    P(allowNoneMsg) = "User-agent: *" CRLF "Disallow: /" CRLF;
-    printP(allowNoneMsg);
+    uint8_t c = pgm_read_byte(routePath + i);
+    if (c != (uint8_t)path[i])
+      return (c == 0) ? -1 : c - (uint8_t)path[i];
   }
+  return pgm_read_byte(routePath + len) == 0 ? 0 : 1;
 }
 
-void WebServer::httpSuccess(const char *contentType,
-                            const char *extraHeaders)
+// Binary search a sorted table in program memory for the first entry
+// whose path isn't less than the len characters at path.  Each entry
+// is entrySize bytes and starts with a pointer to its path.
+static uint8_t webduinoFindPath(const void *table, size_t entrySize,
+                                uint8_t count, const char *path, int len)
 {
-  P(successMsg1) =
-    "HTTP/1.0 200 OK" CRLF
-    WEBDUINO_SERVER_HEADER
-    "Content-Type: ";
+  uint8_t lo = 0, hi = count;
+  while (lo < hi)
+  {
+    uint8_t mid = (lo + hi) / 2;
+    const prog_uchar *p = (const prog_uchar *)
+      pgm_read_ptr((const uint8_t *)table + mid * entrySize);
+    if (webduinoComparePath(p, path, len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
 
-  printP(successMsg1);
-  print(contentType);
-  printCRLF();
-  if (extraHeaders)
-    print(extraHeaders);
-  printCRLF();
+// Look up the len characters at path in the route table.  On success,
+// matchedLen is set to the length of the route's path.
+WEBDUINO_TEMPLATE
+const typename WEBDUINO_SERVER::Route *
+WEBDUINO_SERVER::findRoute(ConnectionType requestType, const char *path,
+                           int len, int *matchedLen)
+{
+  uint8_t method = 1 << requestType;
+  // GET commands also handle HEAD
+  if (requestType == HEAD)
+    method |= ROUTE_GET;
+
+  uint8_t lo = webduinoFindPath(m_routes, sizeof(Route), m_routeCount,
+                                path, len);
+
+  // entries for exactly this path, one per method
+  for (uint8_t i = lo; i < m_routeCount; ++i)
+  {
+    const prog_uchar *p = (const prog_uchar *)pgm_read_ptr(&m_routes[i].path);
+    if (webduinoComparePath(p, path, len) != 0)
+      break;
+    uint8_t flags = pgm_read_byte(&m_routes[i].flags);
+    if ((flags & ~ROUTE_PREFIX) == 0 || (flags & method))
+    {
+      *matchedLen = len;
+      return &m_routes[i];
+    }
+  }
+
+  // any path that's a prefix of this one sorts before it, and the
+  // nearest is the longest.  All of them start with the same
+  // character as path.
+  for (uint8_t i = lo; i-- > 0; )
+  {
+    const prog_uchar *p = (const prog_uchar *)pgm_read_ptr(&m_routes[i].path);
+    if (pgm_read_byte(p) != (uint8_t)path[0])
+      break;
+    uint8_t flags = pgm_read_byte(&m_routes[i].flags);
+    if (!(flags & ROUTE_PREFIX) ||
+        ((flags & ~ROUTE_PREFIX) != 0 && !(flags & method)))
+      continue;
+
+    int j = 0;
+    while (j < len && pgm_read_byte(p + j) == (uint8_t)path[j])
+      ++j;
+    if (pgm_read_byte(p + j) == 0)
+    {
+      *matchedLen = j;
+      return &m_routes[i];
+    }
+  }
+
+  return NULL;
 }
 
-void WebServer::httpSeeOther(const char *otherURL)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::runCommand(Command *cmd, ConnectionType requestType,
+                                 char *tail, bool tail_complete)
 {
-  P(seeOtherMsg) =
-    "HTTP/1.0 303 See Other" CRLF
-    WEBDUINO_SERVER_HEADER
-    "Location: ";
+  WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_START);
+  if (WEBDUINO_HAS(CACHE))
+  {
+    m_command = cmd;
+    m_commandTail = tail;
+  }
+#if WEBDUINO_METRICS
+  // find the command's counters, or the first free ones
+  for (uint8_t i = STATS_COMMANDS;
+       m_routeStats == NULL && i < SIZE(m_stats); ++i)
+  {
+    if (m_stats[i].cmd == NULL)
+      m_stats[i].cmd = cmd;
+    if (m_stats[i].cmd == cmd)
+      m_routeStats = &m_stats[i];
+  }
+#endif
+  cmd(*this, requestType, tail, tail_complete);
+  if (m_measure == MEASURE_COUNTING)
+  {
+    // the command asked for its output to be measured, so now that
+    // it's been counted, run the command again to send it
+    flush();
+    m_measure = MEASURE_COUNTED;
+    cmd(*this, requestType, tail, tail_complete);
+  }
+  WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_DONE);
+}
 
-  printP(seeOtherMsg);
-  print(otherURL);
-  printCRLF();
-  printCRLF();
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::dispatchCommand(ConnectionType requestType, char *verb,
+              bool tail_complete)
+{
+  if ((verb[0] == 0) || ((verb[0] == '/') && (verb[1] == 0)))
+  {
+#if WEBDUINO_METRICS
+    m_routeStats = &m_stats[STATS_DEFAULT];
+#endif
+    WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                         WEBDUINO_TRACE_DEFAULT);
+    runCommand(m_defaultCmd, requestType, verb, tail_complete);
+    return true;
+  }
+  // We now know that the URL contains at least one character.  And,
+  // if the first character is a slash,  there's more after it.
+  if (verb[0] == '/')
+  {
+    uint8_t i;
+    char *qm_loc;
+    int verb_len;
+    int qm_offset;
+    // Skip over the leading "/",  because it makes the code more
+    // efficient and easier to understand.
+    verb++;
+    // Look for a "?" separating the filename part of the URL from the
+    // parameters.  If it's not there, compare to the whole URL.
+    qm_loc = strchr(verb, '?');
+    verb_len = (qm_loc == NULL) ? strlen(verb) : (qm_loc - verb);
+    qm_offset = (qm_loc == NULL) ? 0 : 1;
+
+    if (WEBDUINO_HAS(ASSETS) && m_assetCount > 0 &&
+        (requestType == GET || requestType == HEAD))
+    {
+      uint8_t i = webduinoFindPath(m_assets, sizeof(Asset), m_assetCount,
+                                   verb, verb_len);
+      if (i < m_assetCount &&
+          webduinoComparePath((const prog_uchar *)
+                              pgm_read_ptr(&m_assets[i].path),
+                              verb, verb_len) == 0)
+      {
+        WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_START);
+#if WEBDUINO_METRICS
+        m_routeStats = &m_stats[STATS_BUILTIN];
+#endif
+        WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                             WEBDUINO_TRACE_ASSET | i);
+        sendAsset(&m_assets[i]);
+        WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_DONE);
+        return true;
+      }
+    }
+
+    if (WEBDUINO_HAS(ROUTES) && m_routeCount > 0)
+    {
+      int matchedLen;
+      const Route *route = findRoute(requestType, verb, verb_len,
+                                     &matchedLen);
+      if (route)
+      {
+        Command *cmd = (Command *)pgm_read_ptr(&route->cmd);
+        WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                             WEBDUINO_TRACE_ROUTE | (route - m_routes));
+        // a prefix route gets the rest of the URL; otherwise skip the
+        // question mark like the commands below
+        if (matchedLen == verb_len)
+          runCommand(cmd, requestType, verb + verb_len + qm_offset,
+                     tail_complete);
+        else
+          runCommand(cmd, requestType, verb + matchedLen, tail_complete);
+        return true;
+      }
+    }
+
+    for (i = 0; i < m_cmdCount; ++i)
+    {
+      if ((verb_len == m_commands[i].verbLen)
+          && (strncmp(verb, m_commands[i].verb, verb_len) == 0))
+      {
+        // Skip over the "verb" part of the URL (and the question
+        // mark, if present) when passing it to the "action" routine
+        WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                             WEBDUINO_TRACE_COMMAND | i);
+        runCommand(m_commands[i].cmd, requestType,
+                   verb + verb_len + qm_offset,
+                   tail_complete);
+        return true;
+      }
+    }
+  }
+  return false;
 }
 
-int WebServer::read()
+// processConnection with a default buffer
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::processConnection()
 {
-  if (m_client == NULL)
+  char request[URL_SIZE];
+  int  request_len = URL_SIZE;
+  processConnection(request, &request_len);
+}
+
+// Incremental, case-insensitive matching of text against a table of
+// strings in program memory, one character at a time.  which is the
+// table entry that matched the first "matched" characters; this
+// returns the entry that also matches ch in that position, or
+// WEBDUINO_NO_MATCH.  Start with which and matched both 0.
+#define WEBDUINO_NO_MATCH 0xff
+// which while reading the parameters after a matched header value token
+#define WEBDUINO_IN_PARAMS 0xfe
+// which while reading the first and last positions of a byte range
+#define WEBDUINO_RANGE_FIRST 0xfd
+#define WEBDUINO_RANGE_LAST 0xfc
+
+static uint8_t webduinoMatch(const prog_uchar * const *table, uint8_t count,
+                             uint8_t which, uint8_t matched, uint8_t ch)
+{
+  if (which == WEBDUINO_NO_MATCH)
+    return WEBDUINO_NO_MATCH;
+  if (ch >= 'A' && ch <= 'Z')
+    ch += 'a' - 'A';
+
+  for (uint8_t i = which; i < count; ++i)
+  {
+    // later entries are only candidates if they start the same way
+    uint8_t j = 0;
+    if (i != which)
+    {
+      while (j < matched &&
+             pgm_read_byte(table[i] + j) == pgm_read_byte(table[which] + j))
+        ++j;
+      if (j < matched)
+        continue;
+    }
+    if (pgm_read_byte(table[i] + matched) == ch)
+      return i;
+  }
+  return WEBDUINO_NO_MATCH;
+}
+
+// true if the whole of the table entry has been matched
+static bool webduinoMatched(const prog_uchar * const *table,
+                            uint8_t which, uint8_t matched)
+{
+  return which != WEBDUINO_NO_MATCH && matched > 0 &&
+    pgm_read_byte(table[which] + matched) == 0;
+}
+
+// request methods, in the order of ConnectionType after INVALID
+P(webduinoGet) = "get";
+P(webduinoHead) = "head";
+P(webduinoPost) = "post";
+P(webduinoPut) = "put";
+static const prog_uchar * const webduinoMethods[] =
+  { webduinoGet, webduinoHead, webduinoPost, webduinoPut };
+
+P(webduinoHttp11) = "http/1.1";
+static const prog_uchar * const webduinoVersions[] = { webduinoHttp11 };
+
+// request headers we act on
+enum { WEBDUINO_HEADER_CONTENT_LENGTH, WEBDUINO_HEADER_CONNECTION,
+       WEBDUINO_HEADER_ACCEPT_ENCODING, WEBDUINO_HEADER_RANGE,
+       WEBDUINO_HEADER_UPGRADE, WEBDUINO_HEADER_WEBSOCKET_VERSION,
+       WEBDUINO_HEADER_TRANSFER_ENCODING };
+P(webduinoContentLength) = "content-length";
+P(webduinoConnection) = "connection";
+P(webduinoAcceptEncoding) = "accept-encoding";
+P(webduinoRange) = "range";
+P(webduinoUpgrade) = "upgrade";
+P(webduinoWebSocketVersion) = "sec-websocket-version";
+P(webduinoTransferEncoding) = "transfer-encoding";
+static const prog_uchar * const webduinoHeaders[] =
+  { webduinoContentLength, webduinoConnection, webduinoAcceptEncoding,
+    webduinoRange, webduinoUpgrade, webduinoWebSocketVersion,
+    webduinoTransferEncoding };
+
+// values of the Connection header we act on
+enum { WEBDUINO_CONNECTION_CLOSE, WEBDUINO_CONNECTION_KEEP_ALIVE,
+       WEBDUINO_CONNECTION_UPGRADE };
+P(webduinoClose) = "close";
+P(webduinoKeepAlive) = "keep-alive";
+static const prog_uchar * const webduinoConnectionTokens[] =
+  { webduinoClose, webduinoKeepAlive, webduinoUpgrade };
+
+// the values of the Upgrade and Sec-WebSocket-Version headers that
+// make a WebSocket handshake, and the bits of Connection::upgrade that
+// say each was seen along with "Connection: Upgrade"
+P(webduinoWebSocket) = "websocket";
+static const prog_uchar * const webduinoUpgradeTokens[] =
+  { webduinoWebSocket };
+P(webduinoVersion13) = "13";
+static const prog_uchar * const webduinoVersionTokens[] =
+  { webduinoVersion13 };
+#define WEBDUINO_UPGRADE_CONNECTION 0x01
+#define WEBDUINO_UPGRADE_WEBSOCKET  0x02
+#define WEBDUINO_UPGRADE_VERSION    0x04
+
+// values of the Accept-Encoding header that allow gzip
+P(webduinoGzip) = "gzip";
+P(webduinoAnyEncoding) = "*";
+static const prog_uchar * const webduinoEncodings[] =
+  { webduinoGzip, webduinoAnyEncoding };
+// Connection::encodings.  An explicit verdict on gzip wins over "*",
+// whatever order they come in.
+#define WEBDUINO_ENCODING_GZIP_NAMED 0x01   // gzip is listed...
+#define WEBDUINO_ENCODING_GZIP       0x02   // ...and not with q=0
+#define WEBDUINO_ENCODING_ANY        0x04   // * is listed, not with q=0
+#define WEBDUINO_ENCODING_IN_ANY     0x08   // reading *'s parameters
+
+// the only unit of the Range header
+P(webduinoBytesUnit) = "bytes=";
+static const prog_uchar * const webduinoRangeUnits[] = { webduinoBytesUnit };
+
+// a Range header position longer than this is taken as an error
+#define WEBDUINO_RANGE_MAX 99999999L
+
+// Connection::body: what the headers say about the request's content.
+// While a Content-Length value is read, which is where it's got to in
+// it, and matched counts its digits.
+#define WEBDUINO_BODY_LENGTH 0x01   // a Content-Length has been read
+#define WEBDUINO_BODY_BAD    0x02   // ...and it was no good
+#define WEBDUINO_BODY_CODED  0x04   // sent with a Transfer-Encoding
+enum { WEBDUINO_LENGTH_BEFORE, WEBDUINO_LENGTH_DIGITS,
+       WEBDUINO_LENGTH_AFTER };
+
+// The digit of n at index counting from the left, or -1 if n has no
+// more digits.
+static int8_t webduinoDigit(long n, uint8_t index)
+{
+  uint8_t digits = 1;
+  for (long rest = n; rest >= 10; rest /= 10)
+    ++digits;
+  if (index >= digits)
     return -1;
+  while (++index < digits)
+    n /= 10;
+  return n % 10;
+}
+
+// Run one 64 byte block through SHA-1, keeping only the last 16 words
+// of the message schedule.
+static void webduinoSha1Block(uint32_t *hash, const uint8_t *block)
+{
+  uint32_t w[16];
+  for (uint8_t i = 0; i < 16; ++i)
+    w[i] = ((uint32_t)block[i * 4] << 24) |
+      ((uint32_t)block[i * 4 + 1] << 16) |
+      ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+
+  uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3], e = hash[4];
+  for (uint8_t i = 0; i < 80; ++i)
+  {
+    uint32_t f, k;
+    if (i >= 16)
+    {
+      uint32_t x = w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^
+        w[i & 15];
+      w[i & 15] = (x << 1) | (x >> 31);
+    }
+    if (i < 20)
+    {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    }
+    else if (i < 40)
+    {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    }
+    else if (i < 60)
+    {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    }
+    else
+    {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i & 15];
+    e = d;
+    d = c;
+    c = (b << 30) | (b >> 2);
+    b = a;
+    a = t;
+  }
+  hash[0] += a;
+  hash[1] += b;
+  hash[2] += c;
+  hash[3] += d;
+  hash[4] += e;
+}
+
+// Work out the Sec-WebSocket-Accept header for a 24 character
+// Sec-WebSocket-Key: the base64 of the SHA-1 of the key followed by a
+// fixed GUID.  accept needs room for 28 characters and a NUL.  It's
+// inline so a server that never answers a handshake doesn't warn.
+static inline void webduinoWebSocketAccept(const char *key, char *accept)
+{
+  P(guid) = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  static const char base64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  // the 60 bytes of key and GUID and the padding fill two blocks
+  uint32_t hash[5] =
+    { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+  uint8_t block[64];
+  memcpy(block, key, 24);
+  memcpy_P(block + 24, guid, 36);
+  block[60] = 0x80;
+  block[61] = block[62] = block[63] = 0;
+  webduinoSha1Block(hash, block);
+  memset(block, 0, 62);
+  block[62] = (60 * 8) >> 8;
+  block[63] = (60 * 8) & 0xff;
+  webduinoSha1Block(hash, block);
+
+  for (uint8_t i = 0; i < 20; ++i)
+    block[i] = hash[i / 4] >> (24 - (i & 3) * 8);
+  block[20] = 0;
+
+  // 20 bytes make six full groups of three and two left over
+  char *out = accept;
+  for (uint8_t i = 0; i < 21; i += 3)
+  {
+    uint32_t group = ((uint32_t)block[i] << 16) | (block[i + 1] << 8) |
+      block[i + 2];
+    *out++ = base64[(group >> 18) & 63];
+    *out++ = base64[(group >> 12) & 63];
+    *out++ = base64[(group >> 6) & 63];
+    *out++ = base64[group & 63];
+  }
+  accept[27] = '=';
+  accept[28] = 0;
+}
 
-  if (m_pushbackDepth == 0)
+// WebSocket frame opcodes, and the FIN bit that marks a message's last
+// frame
+#define WEBDUINO_WS_CONTINUATION 0x0
+#define WEBDUINO_WS_TEXT         0x1
+#define WEBDUINO_WS_BINARY       0x2
+#define WEBDUINO_WS_CLOSE        0x8
+#define WEBDUINO_WS_PING         0x9
+#define WEBDUINO_WS_PONG         0xa
+#define WEBDUINO_WS_FIN          0x80
+
+// close frame status codes
+#define WEBDUINO_WS_NORMAL         1000
+#define WEBDUINO_WS_PROTOCOL_ERROR 1002
+#define WEBDUINO_WS_TOO_BIG        1009
+
+// room kept at the start of the output buffer for the header of an
+// outgoing frame, which is never longer than a bufferful
+#define WEBDUINO_WS_SEND_HEADER 4
+
+// frameFill once a frame's header has been read
+#define WEBDUINO_WS_PAYLOAD 0xff
+
+// How long the header of a WebSocket frame is, as far as can be told
+// from the first fill bytes of it.
+static uint8_t webduinoFrameHeaderLength(const uint8_t *header, uint8_t fill)
+{
+  if (fill < 2)
+    return 2;
+  uint8_t length = header[1] & 0x7f;
+  return 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) +
+    ((header[1] & 0x80) ? 4 : 0);
+}
+
+// Look after the sockets bound to our port.  This does the job of
+// Server::available(), but working from socket numbers lets us keep a
+// request's progress for each connection, recognise the connections
+// we've kept open, time them out, and close the least recently used
+// one if every socket on the chip is taken and none is left listening
+// for new connections, or a browser is waiting for a connection.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::scanSockets()
+{
+  unsigned long now = millis();
+  bool listening = false;
+  bool socketFree = false;
+  bool waitingForConn = false;
+  Connection *oldest = NULL;
+  Connection *silent = NULL;
+
+  for (uint8_t sock = 0; sock < MAX_SOCK_NUM; ++sock)
   {
-    unsigned long timeoutTime = millis() + WEBDUINO_READ_TIMEOUT_IN_MS;
+    Connection *found = connection(sock);
+    Client client(sock);
+    uint8_t status = client.status();
+
+    if (status == WEBDUINO_SOCK_CLOSED || status == WEBDUINO_SOCK_LISTEN)
+    {
+      if (m_captureSock == sock)
+        m_captureSock = MAX_SOCK_NUM;
+      if (status == WEBDUINO_SOCK_CLOSED)
+        socketFree = true;
+      else if (EthernetClass::_server_port[sock] == m_port)
+        listening = true;
+      if (found)
+      {
+        bool wasSocket = WEBDUINO_HAS(WEBSOCKETS) &&
+          found->state == PS_WEBSOCKET;
+        found->state = PS_CLOSED;
+        found->idle = false;
+        if (wasSocket)
+          socketClosed(*found);
+      }
+      continue;
+    }
+    if (EthernetClass::_server_port[sock] != m_port)
+      continue;
 
-    while (m_client.connected())
+    bool waiting = client.available() > 0;
+    if (found == NULL)
     {
-      // stop reading the socket early if we get to content-length
-      // characters in the POST.  This is because some clients leave
-      // the socket open because they assume HTTP keep-alive.
-      if (m_readingContent)
+      // a browser we haven't seen before, which has to wait while
+      // every connection is in use
+      found = connection(MAX_SOCK_NUM);
+      if (found == NULL)
       {
-        if (m_contentLength == 0)
+        if (status == WEBDUINO_SOCK_CLOSE_WAIT && !waiting)
         {
-#if WEBDUINO_SERIAL_DEBUGGING > 1
-          Serial.println("\n*** End of content, terminating connection");
-#endif
-          return -1;
+          stopSocket(sock);
+          socketFree = true;
         }
-        --m_contentLength;
+        else if (waiting)
+          waitingForConn = true;
+        continue;
       }
+      found->sock = sock;
+      found->requests = 0;
+      found->lastActive = now;
+      found->started = now;
+#if WEBDUINO_METRICS
+      found->received = 0;
+#endif
+      startRequest(*found, found->urlBuffer, sizeof(found->urlBuffer));
+    }
+    Connection &conn = *found;
 
-      int ch = m_client.read();
-
-      // if we get a character, return it, otherwise continue in while
-      // loop, checking connection status
-      if (ch != -1)
+    if (WEBDUINO_HAS(BROADCAST) &&
+        (conn.state == PS_EVENTS || conn.state == PS_WEBSOCKET))
+    {
+      // an event stream or WebSocket: closed when the browser hangs up
+      // and we've read all it sent, and sent a comment or a ping when
+      // it's been quiet, which also finds out if it's gone
+      bool events = (conn.state == PS_EVENTS);
+      if (status == WEBDUINO_SOCK_CLOSE_WAIT && (events || !waiting))
       {
-#if WEBDUINO_SERIAL_DEBUGGING
-        if (ch == '\r')
-          Serial.print("<CR>");
-        else if (ch == '\n')
-          Serial.println("<LF>");
+        stopSocket(sock);
+        socketFree = true;
+        if (WEBDUINO_HAS(WEBSOCKETS) && !events)
+          socketClosed(conn);
+      }
+      else if (now - conn.lastActive >= WEBDUINO_EVENT_HEARTBEAT_IN_MS &&
+               WEBDUINO_SOCK_TX_FREE(sock) >= 3 && !ponging(sock))
+      {
+        static const uint8_t ping[] =
+          { WEBDUINO_WS_FIN | WEBDUINO_WS_PING, 0 };
+        if (events)
+          client.write((const uint8_t *)":\n\n", 3);
         else
-          Serial.print((char)ch);
+          client.write(ping, sizeof(ping));
+        conn.lastActive = now;
+      }
+      continue;
+    }
+
+    if (status == WEBDUINO_SOCK_CLOSE_WAIT && !waiting)
+    {
+      // the browser has hung up and there's nothing left to read
+#if WEBDUINO_METRICS || WEBDUINO_TRACE
+      if (!conn.idle && (conn.state != PS_METHOD || conn.matched != 0))
+      {
+#if WEBDUINO_METRICS
+        ++m_stats[STATS_FAILURE].drops;
 #endif
-        return ch;
+        WEBDUINO_TRACE_EVENT(WEBDUINO_TRACE_HANGUP, sock, conn.state);
       }
-      else
+#endif
+      stopSocket(sock);
+      socketFree = true;
+    }
+    else if (conn.idle && !waiting)
+    {
+      if (now - conn.lastActive >= m_keepAliveTimeout)
       {
-        unsigned long now = millis();
-        if (now > timeoutTime)
-        {
-          // connection timed out, destroy client, return EOF
+        stopSocket(sock);
+        socketFree = true;
+      }
+      else if (oldest == NULL ||
+               now - conn.lastActive > now - oldest->lastActive)
+        oldest = &conn;
+    }
+    else if (!conn.idle &&
+             ((!waiting &&
+               now - conn.lastActive >= WEBDUINO_READ_TIMEOUT_IN_MS) ||
+              now - conn.started >= WEBDUINO_REQUEST_TIMEOUT_IN_MS))
+    {
+      // stopped sending part way through a request, or is sending it
+      // too slowly to ever finish
 #if WEBDUINO_SERIAL_DEBUGGING
-          Serial.println("*** Connection timed out");
+      Serial.println("*** Connection timed out");
 #endif
-          m_client.flush();
-          m_client.stop();
-          return -1;
-        }
+#if WEBDUINO_METRICS
+      ++m_stats[STATS_FAILURE].timeouts;
+#endif
+      WEBDUINO_TRACE_EVENT(WEBDUINO_TRACE_TIMEOUT, sock, conn.state);
+      // say why, unless it never sent anything, when there's no request
+      // to answer, or the answer would have to wait for room
+      if ((conn.state != PS_METHOD || conn.matched != 0) &&
+          WEBDUINO_SOCK_TX_FREE(sock) >= 128)
+      {
+        m_sock = sock;
+        m_conn = &conn;
+        m_client = client;
+        sendTimeout();
+      }
+      stopSocket(sock);
+      socketFree = true;
+    }
+    else if (!waiting && conn.state == PS_METHOD && conn.matched == 0)
+      silent = &conn;
+  }
+
+  // rather than keep a browser's request waiting, close a connection
+  // whose browser hasn't sent anything
+  if (waitingForConn && oldest == NULL)
+    oldest = silent;
+  if (oldest && (waitingForConn || (!listening && !socketFree)))
+  {
+    stopSocket(oldest->sock);
+    // and go round again to give its connection to the waiting browser
+    if (waitingForConn)
+    {
+      scanSockets();
+      return;
+    }
+  }
+  if (!listening)
+    m_server.begin();
+}
+
+// Pick a connection that has request data waiting, for
+// processConnection.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::acceptClient()
+{
+  scanSockets();
+
+  // start after the last socket served so every connection gets a turn
+  for (uint8_t i = 1; i <= MAX_SOCK_NUM; ++i)
+  {
+    uint8_t sock = (m_sock + i) % MAX_SOCK_NUM;
+    Connection *conn = connection(sock);
+    if (conn && conn->state != PS_EVENTS && Client(sock).available() > 0)
+    {
+      m_sock = sock;
+      m_conn = conn;
+      m_client = Client(m_sock);
+      return true;
+    }
+  }
+  return false;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::stopSocket(uint8_t sock)
+{
+  Client(sock).stop();
+  Connection *conn = connection(sock);
+  if (conn)
+  {
+    conn->state = PS_CLOSED;
+    conn->idle = false;
+  }
+  if (m_captureSock == sock)
+    m_captureSock = MAX_SOCK_NUM;
+}
+
+// The connection using sock, or NULL if it hasn't got one.  Given
+// MAX_SOCK_NUM, a free connection, or NULL if they're all in use.
+WEBDUINO_TEMPLATE
+typename WEBDUINO_SERVER::Connection *
+WEBDUINO_SERVER::connection(uint8_t sock)
+{
+  for (uint8_t i = 0; i < SLOTS; ++i)
+  {
+    Connection &conn = m_conns[i];
+    if (sock == MAX_SOCK_NUM ? conn.state == PS_CLOSED :
+        conn.state != PS_CLOSED && conn.sock == sock)
+      return &conn;
+  }
+  return NULL;
+}
+
+// Get ready to read a new request on a connection, storing its URL in
+// url, which has room for length characters including the NUL.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::startRequest(Connection &conn, char *url, int length)
+{
+  conn.state = PS_METHOD;
+  conn.which = 0;
+  conn.matched = 0;
+  conn.type = INVALID;
+  conn.keepAlive = false;
+  conn.http11 = false;
+  conn.encodings = 0;
+  conn.upgrade = 0;
+  conn.body = 0;
+  conn.contentLength = 0;
+  conn.rangeFirst = -1;
+  conn.rangeLast = -1;
+  conn.url = url;
+  conn.urlEnd = url;
+  conn.urlSpace = length - 1;
+  url[0] = 0;
+}
+
+// Let the request on sock store its headers in the registered
+// buffers, emptying them first.  Returns false if another request is
+// still being read into them.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::claimCaptures(uint8_t sock)
+{
+  if (m_captureSock == sock)
+    return true;
+  if (m_captureSock != MAX_SOCK_NUM)
+    return false;
+
+  m_captureSock = sock;
+  for (uint8_t i = 0; i < m_captureCount; ++i)
+    m_captures[i].buffer[0] = 0;
+  return true;
+}
+
+// Run the request line and headers of a request through parseChar as
+// far as the data that has arrived allows, without waiting for more.
+// Returns true once the blank line ending the headers has been read;
+// anything after that is left in the input buffer for the command.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::parseRequest(Connection &conn)
+{
+  while (true)
+  {
+    if (m_rxHead == m_rxTail && readAvailable() == 0)
+      return false;
+
+    conn.lastActive = millis();
+    while (m_rxHead < m_rxTail)
+    {
+      if (parseChar(conn, m_rxBuffer[m_rxHead++]))
+        return true;
+    }
+  }
+}
+
+// Advance the request parser by one character.  Returns true at the
+// end of the headers.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::parseChar(Connection &conn, uint8_t ch)
+{
+  switch (conn.state)
+  {
+  case PS_METHOD:
+    if (ch == ' ')
+    {
+      if (webduinoMatched(webduinoMethods, conn.which, conn.matched))
+        conn.type = (ConnectionType)(GET + conn.which);
+      conn.state = PS_URL;
+    }
+    else if (ch == '\n')
+    {
+      // blank lines before a request are ignored, as browsers sometimes
+      // follow POST content with one
+      if (conn.matched != 0)
+        conn.state = PS_LINE_START;
+    }
+    else if (ch != '\r')
+    {
+      conn.which = webduinoMatch(webduinoMethods, SIZE(webduinoMethods),
+                                 conn.which, conn.matched++, ch);
+      // methods are case sensitive, unlike the headers
+      if (ch >= 'a' && ch <= 'z')
+        conn.which = WEBDUINO_NO_MATCH;
+    }
+    break;
+
+  case PS_URL:
+    if (ch == ' ' || ch == '\r' || ch == '\n')
+    {
+      *conn.urlEnd = 0;
+      conn.which = 0;
+      conn.matched = 0;
+      conn.state = (ch == '\n') ? PS_LINE_START : PS_VERSION;
+      WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_REQUEST_DONE);
+      WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_REQUEST_DONE, m_sock, conn.type);
+    }
+    else if (conn.urlSpace > 0)
+    {
+      *conn.urlEnd++ = ch;
+      --conn.urlSpace;
+    }
+    else
+      conn.urlSpace = -1;
+    break;
+
+  case PS_VERSION:
+    if (ch == '\n')
+    {
+      // HTTP/1.1 connections are persistent unless the browser says
+      // otherwise in the headers; older ones have to ask
+      conn.http11 =
+        webduinoMatched(webduinoVersions, conn.which, conn.matched);
+      conn.keepAlive = conn.http11;
+      conn.state = PS_LINE_START;
+    }
+    else if (ch != '\r')
+      conn.which = webduinoMatch(webduinoVersions, SIZE(webduinoVersions),
+                                 conn.which, conn.matched++, ch);
+    break;
+
+  case PS_LINE_START:
+    if (ch == '\n')
+      return true;
+    if (ch == '\r')
+      break;
+    if (ch == ' ' || ch == '\t')
+    {
+      // continuation of the previous header, which we don't need
+      conn.state = PS_SKIP;
+      break;
+    }
+    conn.which = 0;
+    conn.capture = (m_captureSock == m_sock) ? 0 : WEBDUINO_NO_MATCH;
+    conn.matched = 0;
+    conn.state = PS_NAME;
+    // fall through to start matching the header name
+
+  case PS_NAME:
+    if (ch == ':')
+    {
+      // a header can be both one we act on and one that's registered
+      conn.header = webduinoMatched(webduinoHeaders, conn.which,
+                                    conn.matched) ?
+        conn.which : WEBDUINO_NO_MATCH;
+      if (!webduinoMatched(m_captureNames, conn.capture, conn.matched))
+        conn.capture = WEBDUINO_NO_MATCH;
+
+      if (conn.header != WEBDUINO_NO_MATCH ||
+          conn.capture != WEBDUINO_NO_MATCH)
+      {
+        conn.which = 0;
+        conn.matched = 0;
+        conn.captureFill = 0;
+        if (conn.capture != WEBDUINO_NO_MATCH)
+          m_captures[conn.capture].buffer[0] = 0;
+        conn.state = PS_VALUE;
       }
+      else
+        conn.state = PS_SKIP;
+    }
+    else if (ch == '\n')
+      conn.state = PS_LINE_START;
+    else if (conn.which != WEBDUINO_NO_MATCH ||
+             conn.capture != WEBDUINO_NO_MATCH)
+    {
+      conn.which = webduinoMatch(webduinoHeaders, SIZE(webduinoHeaders),
+                                 conn.which, conn.matched, ch);
+      conn.capture = webduinoMatch(m_captureNames, m_captureCount,
+                                   conn.capture, conn.matched, ch);
+      ++conn.matched;
+    }
+    break;
+
+  case PS_VALUE:
+    if (ch == '\n')
+    {
+      headerValueDone(conn);
+      if (conn.capture != WEBDUINO_NO_MATCH)
+      {
+        // drop trailing white space
+        char *value = m_captures[conn.capture].buffer;
+        while (conn.captureFill > 0 &&
+               (value[conn.captureFill - 1] == ' ' ||
+                value[conn.captureFill - 1] == '\t'))
+          value[--conn.captureFill] = 0;
+      }
+      conn.state = PS_LINE_START;
     }
+    else if (ch != '\r')
+      headerValueChar(conn, ch);
+    break;
+
+  case PS_SKIP:
+    if (ch == '\n')
+      conn.state = PS_LINE_START;
+    break;
+  }
+
+  return false;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::headerValueChar(Connection &conn, uint8_t ch)
+{
+  if (conn.capture != WEBDUINO_NO_MATCH)
+  {
+    // store the value without leading white space
+    HeaderCapture &capture = m_captures[conn.capture];
+    if (conn.captureFill + 1 < capture.length &&
+        (conn.captureFill > 0 || (ch != ' ' && ch != '\t')))
+    {
+      capture.buffer[conn.captureFill++] = ch;
+      capture.buffer[conn.captureFill] = 0;
+    }
+  }
+
+  switch (conn.header)
+  {
+  case WEBDUINO_HEADER_CONTENT_LENGTH:
+    // digits with nothing but white space around them.  A second
+    // Content-Length is compared with the first, digit by digit.
+    if (conn.body & WEBDUINO_BODY_BAD)
+      break;
+    if (ch == ' ' || ch == '\t')
+    {
+      if (conn.which == WEBDUINO_LENGTH_DIGITS)
+        conn.which = WEBDUINO_LENGTH_AFTER;
+    }
+    else if (ch < '0' || ch > '9' || conn.which == WEBDUINO_LENGTH_AFTER)
+      conn.body |= WEBDUINO_BODY_BAD;
+    else
+    {
+      uint8_t digit = ch - '0';
+      conn.which = WEBDUINO_LENGTH_DIGITS;
+      if (conn.body & WEBDUINO_BODY_LENGTH)
+      {
+        if (webduinoDigit(conn.contentLength, conn.matched++) != digit)
+          conn.body |= WEBDUINO_BODY_BAD;
+      }
+      else if (conn.contentLength >
+               (WEBDUINO_CONTENT_LENGTH_MAX - digit) / 10)
+        conn.body |= WEBDUINO_BODY_BAD;
+      else
+      {
+        conn.contentLength = conn.contentLength * 10 + digit;
+        ++conn.matched;
+      }
+    }
+    break;
+
+  case WEBDUINO_HEADER_CONNECTION:
+  case WEBDUINO_HEADER_UPGRADE:
+  case WEBDUINO_HEADER_WEBSOCKET_VERSION:
+    // a comma separated list of tokens
+    if (ch == ',' || ch == ' ' || ch == '\t')
+    {
+      headerValueDone(conn);
+      conn.which = 0;
+      conn.matched = 0;
+    }
+    else if (conn.which != WEBDUINO_NO_MATCH)
+    {
+      if (conn.header == WEBDUINO_HEADER_CONNECTION)
+        conn.which = webduinoMatch(webduinoConnectionTokens,
+                                   SIZE(webduinoConnectionTokens),
+                                   conn.which, conn.matched++, ch);
+      else if (conn.header == WEBDUINO_HEADER_UPGRADE)
+        conn.which = webduinoMatch(webduinoUpgradeTokens,
+                                   SIZE(webduinoUpgradeTokens),
+                                   conn.which, conn.matched++, ch);
+      else
+        conn.which = webduinoMatch(webduinoVersionTokens,
+                                   SIZE(webduinoVersionTokens),
+                                   conn.which, conn.matched++, ch);
+    }
+    break;
+
+  case WEBDUINO_HEADER_ACCEPT_ENCODING:
+    // a comma separated list of codings, each of which may be given a
+    // weight with ";q=", where 0 means it's not acceptable
+    if (ch == ',')
+    {
+      headerValueDone(conn);
+      conn.which = 0;
+      conn.matched = 0;
+    }
+    else if (ch == ' ' || ch == '\t')
+      ;
+    else if (conn.which == WEBDUINO_IN_PARAMS)
+    {
+      // matched is 1 after "q", 2 after "q=" while the weight has no
+      // digits but zeros, and 3 otherwise
+      if (ch == ';')
+      {
+        headerValueDone(conn);
+        conn.matched = 0;
+      }
+      else if (conn.matched == 0 && (ch == 'q' || ch == 'Q'))
+        conn.matched = 1;
+      else if (conn.matched == 1 && ch == '=')
+        conn.matched = 2;
+      else if (conn.matched != 2 || (ch != '0' && ch != '.'))
+        conn.matched = 3;
+    }
+    else if (ch == ';')
+    {
+      headerValueDone(conn);
+      if (conn.which != WEBDUINO_NO_MATCH)
+      {
+        conn.which = WEBDUINO_IN_PARAMS;
+        conn.matched = 0;
+      }
+    }
+    else if (conn.which != WEBDUINO_NO_MATCH)
+      conn.which = webduinoMatch(webduinoEncodings, SIZE(webduinoEncodings),
+                                 conn.which, conn.matched++, ch);
+    break;
+
+  case WEBDUINO_HEADER_RANGE:
+    // "bytes=first-last", "bytes=first-" or "bytes=-suffix length"
+    if (ch == ' ' || ch == '\t' || conn.which == WEBDUINO_NO_MATCH)
+      break;
+    if (conn.which != WEBDUINO_RANGE_FIRST &&
+        conn.which != WEBDUINO_RANGE_LAST)
+    {
+      if (!webduinoMatched(webduinoRangeUnits, conn.which, conn.matched))
+      {
+        conn.which = webduinoMatch(webduinoRangeUnits,
+                                   SIZE(webduinoRangeUnits),
+                                   conn.which, conn.matched++, ch);
+        break;
+      }
+      conn.which = WEBDUINO_RANGE_FIRST;
+    }
+    {
+      long &pos = (conn.which == WEBDUINO_RANGE_FIRST) ?
+        conn.rangeFirst : conn.rangeLast;
+      if (ch >= '0' && ch <= '9' && pos <= WEBDUINO_RANGE_MAX / 10)
+        pos = ((pos < 0) ? 0 : pos * 10) + ch - '0';
+      else if (ch == '-' && conn.which == WEBDUINO_RANGE_FIRST)
+        conn.which = WEBDUINO_RANGE_LAST;
+      else
+      {
+        // not something we understand, including a list of ranges, so
+        // the whole body will be sent
+        conn.which = WEBDUINO_NO_MATCH;
+        conn.rangeFirst = conn.rangeLast = -1;
+      }
+    }
+    break;
+  }
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::headerValueDone(Connection &conn)
+{
+  switch (conn.header)
+  {
+  case WEBDUINO_HEADER_CONTENT_LENGTH:
+    // no digits, or fewer than the first Content-Length had
+    if (conn.which == WEBDUINO_LENGTH_BEFORE ||
+        ((conn.body & WEBDUINO_BODY_LENGTH) &&
+         webduinoDigit(conn.contentLength, conn.matched) >= 0))
+      conn.body |= WEBDUINO_BODY_BAD;
+    conn.body |= WEBDUINO_BODY_LENGTH;
+    break;
+
+  case WEBDUINO_HEADER_TRANSFER_ENCODING:
+    // chunked content, which we can't read
+    conn.body |= WEBDUINO_BODY_CODED;
+    break;
+
+  case WEBDUINO_HEADER_CONNECTION:
+    if (!webduinoMatched(webduinoConnectionTokens, conn.which, conn.matched))
+      break;
+    if (conn.which == WEBDUINO_CONNECTION_UPGRADE)
+      conn.upgrade |= WEBDUINO_UPGRADE_CONNECTION;
+    else
+      conn.keepAlive = (conn.which == WEBDUINO_CONNECTION_KEEP_ALIVE);
+    break;
+
+  case WEBDUINO_HEADER_UPGRADE:
+    if (webduinoMatched(webduinoUpgradeTokens, conn.which, conn.matched))
+      conn.upgrade |= WEBDUINO_UPGRADE_WEBSOCKET;
+    break;
+
+  case WEBDUINO_HEADER_WEBSOCKET_VERSION:
+    if (webduinoMatched(webduinoVersionTokens, conn.which, conn.matched))
+      conn.upgrade |= WEBDUINO_UPGRADE_VERSION;
+    break;
+
+  case WEBDUINO_HEADER_ACCEPT_ENCODING:
+    if (conn.which == WEBDUINO_IN_PARAMS)
+    {
+      // "q=0" takes back the coding we've just accepted
+      if (conn.matched == 2)
+        conn.encodings &= (conn.encodings & WEBDUINO_ENCODING_IN_ANY) ?
+          ~WEBDUINO_ENCODING_ANY : ~WEBDUINO_ENCODING_GZIP;
+    }
+    else if (webduinoMatched(webduinoEncodings, conn.which, conn.matched))
+    {
+      if (webduinoEncodings[conn.which] == webduinoGzip)
+        conn.encodings = (conn.encodings & ~WEBDUINO_ENCODING_IN_ANY) |
+          WEBDUINO_ENCODING_GZIP_NAMED | WEBDUINO_ENCODING_GZIP;
+      else
+        conn.encodings |= WEBDUINO_ENCODING_ANY | WEBDUINO_ENCODING_IN_ANY;
+    }
+    else
+      conn.which = WEBDUINO_NO_MATCH;
+    break;
+
+  case WEBDUINO_HEADER_RANGE:
+    // we need a "-" and at least one of the positions, in order
+    if (conn.which != WEBDUINO_RANGE_LAST ||
+        (conn.rangeFirst < 0 && conn.rangeLast < 0) ||
+        (conn.rangeLast >= 0 && conn.rangeFirst > conn.rangeLast))
+      conn.rangeFirst = conn.rangeLast = -1;
+    break;
+  }
+}
+
+// m_incidents: what went wrong while reading the request being answered
+#define WEBDUINO_INCIDENT_TIMEOUT 0x01
+#define WEBDUINO_INCIDENT_DROP    0x02
+
+// Run the command for a request whose headers have been read, or that
+// the browser gave up on part way through if complete is false.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::handleRequest(Connection &conn, bool complete)
+{
+  char *buff = conn.url;
+  bool tail_complete = conn.urlSpace >= 0;
+  ConnectionType requestType = conn.type;
+#if WEBDUINO_METRICS || WEBDUINO_TRACE
+  unsigned long sent = m_sent;
+#endif
+#if WEBDUINO_METRICS
+  unsigned long started = micros();
+  if (!complete)
+    m_incidents |= WEBDUINO_INCIDENT_DROP;
+#endif
+
+  *conn.urlEnd = 0;
+  m_requestType = requestType;
+  m_readingContent = complete;
+  m_contentLength = conn.contentLength;
+  m_contentTotal = conn.contentLength;
+  m_contentSent = m_sent;
+  conn.started = millis();
+  m_acceptGzip = (conn.encodings & WEBDUINO_ENCODING_GZIP_NAMED) ?
+    (conn.encodings & WEBDUINO_ENCODING_GZIP) != 0 :
+    (conn.encodings & WEBDUINO_ENCODING_ANY) != 0;
+  m_rangeFirst = conn.rangeFirst;
+  m_rangeLast = conn.rangeLast;
+  m_http11 = conn.http11;
+
+  // only keep the connection if the request was read completely, and
+  // we know where the next one starts
+  m_keepAlive = conn.keepAlive && complete && requestType != INVALID &&
+    !(conn.body & (WEBDUINO_BODY_BAD | WEBDUINO_BODY_CODED)) &&
+    m_keepAliveTimeout != 0 && conn.requests + 1 < m_keepAliveMax;
+
+  WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HEADERS_DONE);
+  WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HEADERS_DONE, m_sock,
+                       webduinoTraceCount(conn.contentLength));
+#if WEBDUINO_SERIAL_DEBUGGING > 1
+  Serial.print("*** requestType = ");
+  Serial.print((int)requestType);
+  Serial.println(", request = \"");
+  Serial.print(buff);
+  Serial.println("\" ***");
+  Serial.println("*** headers complete ***");
+#endif
+
+  int urlPrefixLen = strlen(m_urlPrefix);
+  if (conn.body & (WEBDUINO_BODY_BAD | WEBDUINO_BODY_CODED))
+  {
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_START);
+#if WEBDUINO_METRICS
+    m_routeStats = &m_stats[STATS_FAILURE];
+#endif
+    WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                         WEBDUINO_TRACE_FAILURE);
+    rejectContent(conn.body);
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_DONE);
+  }
+  else if (strcmp(buff, "/robots.txt") == 0)
+  {
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_START);
+#if WEBDUINO_METRICS
+    m_routeStats = &m_stats[STATS_BUILTIN];
+#endif
+    WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                         WEBDUINO_TRACE_ROBOTS);
+    noRobots(requestType);
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_DONE);
+  }
+#if WEBDUINO_METRICS && defined(WEBDUINO_STATUS_URL)
+  else if (strcmp(buff, WEBDUINO_STATUS_URL) == 0)
+  {
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_START);
+    m_routeStats = &m_stats[STATS_BUILTIN];
+    WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                         WEBDUINO_TRACE_STATUS);
+    sendStatus(requestType);
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_DONE);
+  }
+#endif
+#if WEBDUINO_TRACE && defined(WEBDUINO_TRACE_URL)
+  else if (strcmp(buff, WEBDUINO_TRACE_URL) == 0)
+  {
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_START);
+#if WEBDUINO_METRICS
+    m_routeStats = &m_stats[STATS_BUILTIN];
+#endif
+    WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                         WEBDUINO_TRACE_DUMP);
+    sendTrace(requestType);
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_HANDLER_DONE);
+  }
+#endif
+  else if (requestType == INVALID ||
+           strncmp(buff, m_urlPrefix, urlPrefixLen) != 0 ||
+           !dispatchCommand(requestType, buff + urlPrefixLen,
+                            tail_complete))
+  {
+#if WEBDUINO_METRICS
+    m_routeStats = &m_stats[STATS_FAILURE];
+#endif
+    WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_START, m_sock,
+                         WEBDUINO_TRACE_FAILURE);
+    runCommand(m_failureCmd, requestType, buff, tail_complete);
+  }
+  // with the bytes the response has come to
+  WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_HANDLER_DONE, m_sock,
+                       webduinoTraceCount(m_sent + m_bufFill - sent));
+
+  finishResponse();
+#if WEBDUINO_METRICS
+  countRequest(conn, started, sent, tail_complete);
+#endif
+  if (m_captureSock == m_sock)
+    m_captureSock = MAX_SOCK_NUM;
+  WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_STOP);
+  // with the state it's left the connection in, PS_CLOSED if closed
+  WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_STOP, m_sock, conn.state);
+}
+
+// Either close the connection or, if the response allowed it, leave
+// it open for the browser's next request.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::finishResponse()
+{
+  Connection &conn = *m_conn;
+  if (m_chunked)
+  {
+    // the last chunk is empty, with no trailing headers after it
+    P(lastChunk) = "0" CRLF CRLF;
+    closeChunk();
+    m_chunked = false;
+    m_bufLimit = sizeof(m_buffer);
+    printP(lastChunk);
+  }
+  flush();
+
+  // if a measured command sent a different amount the second time,
+  // its Content-Length was wrong and the browser would lose its place
+  if (m_measure == MEASURE_SENDING && m_sent != m_measureEnd)
+    m_persist = false;
+  m_measure = MEASURE_OFF;
+  if (WEBDUINO_HAS(CACHE) && m_caching)
+    finishCache();
+
+  if (WEBDUINO_HAS(BROADCAST) && m_switchState != PS_CLOSED)
+  {
+    // an event stream or WebSocket stays open without reading requests
+    uint8_t state = m_switchState;
+    m_switchState = PS_CLOSED;
+    if (m_client.connected())
+    {
+      conn.state = state;
+      conn.idle = false;
+      conn.lastActive = millis();
+      if (WEBDUINO_HAS(WEBSOCKETS) && state == PS_WEBSOCKET)
+      {
+        conn.frameFill = 0;
+        conn.messageOp = 0;
+        callSocket(conn, SOCKET_OPEN, NULL, 0);
+      }
+      return;
+    }
+  }
+
+  if (m_persist && m_client.connected() && m_readingContent)
+  {
+    // throw away any POST data the command didn't read, as far as it
+    // has arrived.  Waiting for the rest would hold up the server, so
+    // a connection with some still to come is closed instead.
+    do
+    {
+      long buffered = m_rxTail - m_rxHead;
+      if (buffered > m_contentLength)
+        buffered = m_contentLength;
+      m_rxHead += buffered;
+      m_contentLength -= buffered;
+    } while (m_contentLength > 0 && readAvailable() > 0);
+    if (m_contentLength > 0)
+      m_persist = false;
+  }
+
+  if (m_persist)
+  {
+    // anything still buffered is the start of the browser's next
+    // request, which nextRequest() picks up, even once the browser
+    // has sent its last and half-closed the connection
+    if (m_client.connected() ||
+        (m_rxHead != m_rxTail &&
+         m_client.status() == WEBDUINO_SOCK_CLOSE_WAIT))
+    {
+      conn.idle = true;
+      conn.lastActive = millis();
+      ++conn.requests;
+      startRequest(conn, conn.urlBuffer, sizeof(conn.urlBuffer));
+      return;
+    }
+  }
+
+#if WEBDUINO_SERIAL_DEBUGGING > 1
+  Serial.println("*** stopping connection ***");
+#endif
+  m_client.stop();
+  conn.state = PS_CLOSED;
+  conn.idle = false;
+}
+
+// Get ready to answer the next request on a connection left open, if
+// the browser sent it without waiting for the last response and it's
+// already in m_rxBuffer.  Pipelined requests like that have to be
+// answered in order, and before m_rxBuffer is used for another
+// connection, so the caller reads this one straight away when it
+// returns true.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::nextRequest(Connection &conn)
+{
+  if (!conn.idle)
+    return false;
+
+  // a stray blank line after POST content is no request
+  while (m_rxHead < m_rxTail &&
+         (m_rxBuffer[m_rxHead] == '\r' || m_rxBuffer[m_rxHead] == '\n'))
+    ++m_rxHead;
+  if (m_rxHead == m_rxTail)
+    return false;
+
+  size_t head = m_rxHead;
+  size_t tail = m_rxTail;
+  reset();
+  m_rxHead = head;
+  m_rxTail = tail;
+  conn.idle = false;
+  conn.started = millis();
+  WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_ACCEPT);
+  WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_ACCEPT, m_sock, conn.requests);
+  return true;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::processConnection(char *buff, int *bufflen)
+{
+  if (acceptClient())
+  {
+    Connection &conn = *m_conn;
+    bool complete;
+
+    if (WEBDUINO_HAS(WEBSOCKETS) && conn.state == PS_WEBSOCKET)
+    {
+      reset();
+      readWebSocket(conn);
+      return;
+    }
+
+    WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_ACCEPT);
+    // with the requests answered on the connection before this one
+    WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_ACCEPT, m_sock, conn.requests);
+    reset();
+    conn.idle = false;
+    conn.started = millis();
+    int length = *bufflen;
+    do
+    {
+      startRequest(conn, buff, length);
+      // this request is read to the end before anything else is
+      m_captureSock = MAX_SOCK_NUM;
+      claimCaptures(m_sock);
+#if WEBDUINO_SERIAL_DEBUGGING > 1
+      Serial.println("*** checking request ***");
+#endif
+
+      // wait for the rest of the request when it hasn't all arrived
+      while (!(complete = parseRequest(conn)) && fillBuffer(1, true))
+        ;
+
+      // tell the caller how much room was left, negative if the URL
+      // didn't fit
+      *bufflen = conn.urlSpace;
+      handleRequest(conn, complete);
+      // then any requests the browser sent behind this one
+    } while (nextRequest(conn));
+  }
+#if WEBDUINO_TRACE
+  else if (m_traceOut)
+    dumpTrace(*m_traceOut, 1);
+#endif
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::poll()
+{
+  scanSockets();
+#if WEBDUINO_TRACE
+  bool busy = false;
+#endif
+
+  for (uint8_t i = 1; i <= MAX_SOCK_NUM; ++i)
+  {
+    uint8_t sock = (m_sock + i) % MAX_SOCK_NUM;
+    Connection *found = connection(sock);
+    if (found == NULL || found->state == PS_EVENTS ||
+        Client(sock).available() == 0)
+      continue;
+    Connection &conn = *found;
+#if WEBDUINO_TRACE
+    busy = true;
+#endif
+    if (WEBDUINO_HAS(WEBSOCKETS) && conn.state == PS_WEBSOCKET)
+    {
+      m_sock = sock;
+      m_conn = &conn;
+      m_client = Client(sock);
+      reset();
+      readWebSocket(conn);
+      continue;
+    }
+    // leave the request where it is while another is being read into
+    // the registered header buffers
+    if (m_captureCount > 0 && !claimCaptures(sock))
+      continue;
+
+    m_sock = sock;
+    m_conn = &conn;
+    m_client = Client(sock);
+    reset();
+    if (conn.idle)
+      conn.started = millis();
+    if (conn.idle || (conn.state == PS_METHOD && conn.matched == 0))
+    {
+      WEBDUINO_PHASE_HOOK(WEBDUINO_PHASE_ACCEPT);
+      WEBDUINO_TRACE_EVENT(WEBDUINO_PHASE_ACCEPT, sock, conn.requests);
+    }
+    conn.idle = false;
+
+    // then any requests the browser sent behind this one, as far as
+    // they've arrived
+    while (parseRequest(conn))
+    {
+      handleRequest(conn, true);
+      if (!nextRequest(conn))
+        break;
+      claimCaptures(sock);
+    }
+  }
+#if WEBDUINO_TRACE
+  if (!busy && m_traceOut)
+    dumpTrace(*m_traceOut, 1);
+#endif
+}
+
+// Output the status line and the headers every response gets.  When
+// persistent connections are turned on we answer as HTTP/1.1 and tell
+// the browser whether the connection will stay open, which it can
+// only do when the length of the response is known.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::printStatus(const prog_uchar *status, long contentLength)
+{
+  P(http10) = "HTTP/1.0 ";
+  P(http11) = "HTTP/1.1 ";
+  P(serverHeader) = WEBDUINO_SERVER_HEADER;
+  P(lengthHeader) = "Content-Length: ";
+  P(keepAliveHeader) = "Connection: keep-alive" CRLF;
+  P(closeHeader) = "Connection: close" CRLF;
+  P(chunkedHeader) = "Transfer-Encoding: chunked" CRLF;
+
+  m_persist = m_keepAlive && (contentLength >= 0 || contentLength == CHUNKED);
+
+  printP(m_keepAliveTimeout ? http11 : http10);
+  printP(status);
+  printCRLF();
+  printP(serverHeader);
+  if (contentLength >= 0)
+  {
+    printP(lengthHeader);
+    print(contentLength);
+    printCRLF();
+  }
+  else if (contentLength == CHUNKED)
+    printP(chunkedHeader);
+  if (m_keepAliveTimeout)
+    printP(m_persist ? keepAliveHeader : closeHeader);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::httpFail()
+{
+  P(failStatus) = "400 Bad Request";
+  P(failMsg1) =
+    "Content-Type: text/html" CRLF
+    CRLF;
+  P(failMsg2) = WEBDUINO_FAIL_MESSAGE;
+
+  printStatus(failStatus, sizeof(failMsg2) - 1);
+  printP(failMsg1);
+  if (m_requestType != HEAD)
+    printP(failMsg2);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::defaultFailCmd(WebServerT &server,
+                                     ConnectionType type,
+                                     char *url_tail,
+                                     bool tail_complete)
+{
+  server.httpFail();
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::noRobots(ConnectionType type)
+{
+  P(allowNoneMsg) = "User-agent: *" CRLF "Disallow: /" CRLF;
+
+  httpSuccess("text/plain", NULL, sizeof(allowNoneMsg) - 1);
+  if (type != HEAD)
+    printP(allowNoneMsg);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::httpSuccess(const char *contentType,
+                                  const char *extraHeaders,
+                                  long contentLength)
+{
+  P(successStatus) = "200 OK";
+  P(successMsg1) = "Content-Type: ";
+
+  if (contentLength == MEASURE)
+  {
+    if (m_measure == MEASURE_COUNTED)
+      contentLength = m_measured;
+    else if (!m_keepAlive)
+      contentLength = -1;       // the connection is closing anyway
+    else if (m_requestType != GET)
+      contentLength = CHUNKED;  // no body to count, or one read only once
+    else
+    {
+      // count the body; runCommand() will run the command again
+      m_measure = MEASURE_COUNTING;
+      m_measureStart = m_bufFill;
+      m_measured = 0;
+      return;
+    }
+  }
+
+  // chunks need HTTP/1.1 at both ends
+  if (contentLength == CHUNKED && !(m_http11 && m_keepAliveTimeout))
+    contentLength = -1;
+
+  printStatus(successStatus, contentLength);
+  printP(successMsg1);
+  print(contentType);
+  printCRLF();
+  if (extraHeaders)
+    print(extraHeaders);
+  printCRLF();
+
+  if (m_measure == MEASURE_COUNTED)
+  {
+    m_measure = MEASURE_SENDING;
+    m_measureEnd = m_sent + m_bufFill + m_measured;
+  }
+
+  // a HEAD response says it would be chunked, but has no body at all
+  if (contentLength == CHUNKED && m_requestType != HEAD)
+  {
+    if (m_bufFill + WEBDUINO_CHUNK_SIZE_LINE >= sizeof(m_buffer) - 2)
+      flush();
+    m_chunked = true;
+    m_bufLimit = sizeof(m_buffer) - 2;
+    openChunk();
+  }
+}
+
+// true if the If-None-Match header of the request names etag followed
+// by suffix (if not NULL), or is "*".  The header is a comma separated
+// list of quoted ETags, each of which may be marked weak with "W/".
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::etagMatches(const prog_uchar *etag,
+                                  const prog_uchar *suffix)
+{
+  const char *p = m_ifNoneMatch;
+  while (*p)
+  {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      ++p;
+    if (*p == '*')
+      return true;
+    if (p[0] == 'W' && p[1] == '/')
+      p += 2;
+    if (*p++ != '"')
+      return false;
+
+    // compare up to the closing quote
+    const prog_uchar *e = etag;
+    const prog_uchar *next = suffix;
+    while (*p && *p != '"' && pgm_read_byte(e) == (uint8_t)*p)
+    {
+      ++p;
+      if (pgm_read_byte(++e) == 0 && next)
+      {
+        e = next;
+        next = NULL;
+      }
+    }
+    if (*p == '"' && pgm_read_byte(e) == 0 && !next)
+      return true;
+
+    // on to the next one
+    while (*p && *p != ',')
+      ++p;
+  }
+  return false;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::sendAsset(const Asset *asset)
+{
+  P(notModifiedStatus) = "304 Not Modified";
+  P(notAcceptableStatus) = "406 Not Acceptable";
+  P(typeHeader) = "Content-Type: ";
+  P(gzipHeader) = "Content-Encoding: gzip" CRLF;
+  P(varyHeader) = "Vary: Accept-Encoding" CRLF;
+  P(etagHeader) = "ETag: \"";
+  P(gzipSuffix) = "-gz";
+  P(cacheHeader) = "\"" CRLF "Cache-Control: " WEBDUINO_ASSET_CACHE_CONTROL CRLF;
+
+  const prog_uchar *etag = (const prog_uchar *)pgm_read_ptr(&asset->etag);
+  const prog_uchar *data = (const prog_uchar *)pgm_read_ptr(&asset->data);
+  uint16_t length = pgm_read_word(&asset->length);
+  const prog_uchar *gzipData =
+    (const prog_uchar *)pgm_read_ptr(&asset->gzipData);
+
+  // the compressed copy is a different representation, so it gets its
+  // own ETag
+  bool gzip = gzipData && m_acceptGzip;
+  if (gzip)
+  {
+    data = gzipData;
+    length = pgm_read_word(&asset->gzipLength);
+  }
+  else if (!data)
+  {
+    printStatus(notAcceptableStatus, 0);
+    printP(varyHeader);
+    printCRLF();
+    return;
+  }
+  const prog_uchar *suffix = gzip ? gzipSuffix : NULL;
+  bool notModified = etagMatches(etag, suffix);
+  long offset = 0;
+  long count = length;
+
+  // a 304 gives the length the asset would have had, which is allowed
+  // and keeps the connection open
+  if (notModified)
+    printStatus(notModifiedStatus, length);
+  else
+  {
+    RangeResult range = selectRange(length, &offset, &count);
+    printRangeStatus(range, count);
+    printP(typeHeader);
+    printP((const prog_uchar *)pgm_read_ptr(&asset->contentType));
+    printCRLF();
+    if (gzip)
+      printP(gzipHeader);
+    printRangeHeaders(range, offset, count, length);
+  }
+  if (gzipData)
+    printP(varyHeader);
+  printP(etagHeader);
+  printP(etag);
+  if (suffix)
+    printP(suffix);
+  printP(cacheHeader);
+  printCRLF();
+
+  if (!notModified && m_requestType != HEAD)
+    writeP(data + offset, count);
+}
+
+// Work out which part of a body of length bytes the request's Range
+// header asks for, setting offset and count to the bytes to send.
+WEBDUINO_TEMPLATE
+typename WEBDUINO_SERVER::RangeResult
+WEBDUINO_SERVER::selectRange(long length, long *offset, long *count)
+{
+  long first = m_rangeFirst;
+  long last = m_rangeLast;
+
+  *offset = 0;
+  *count = length;
+  if (first < 0 && last < 0)
+    return RANGE_WHOLE;
+
+  if (first < 0)
+  {
+    // the last "last" bytes
+    first = (last >= length) ? 0 : length - last;
+    last = (last == 0) ? -1 : length - 1;
+  }
+  else if (last < 0 || last >= length)
+    last = length - 1;
+
+  if (first >= length || last < first)
+  {
+    *count = 0;
+    return RANGE_UNSATISFIABLE;
+  }
+  *offset = first;
+  *count = last - first + 1;
+  return RANGE_PART;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::printRangeStatus(RangeResult range, long count)
+{
+  P(okStatus) = "200 OK";
+  P(partialStatus) = "206 Partial Content";
+  P(unsatisfiableStatus) = "416 Range Not Satisfiable";
+
+  printStatus(range == RANGE_PART ? partialStatus :
+              range == RANGE_UNSATISFIABLE ? unsatisfiableStatus : okStatus,
+              count);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::printRangeHeaders(RangeResult range, long offset,
+                                        long count, long length)
+{
+  P(acceptRangesHeader) = "Accept-Ranges: bytes" CRLF;
+  P(contentRangeHeader) = "Content-Range: bytes ";
+
+  printP(acceptRangesHeader);
+  if (range == RANGE_WHOLE)
+    return;
+
+  printP(contentRangeHeader);
+  if (range == RANGE_PART)
+  {
+    print(offset);
+    print('-');
+    print(offset + count - 1);
+  }
+  else
+    print('*');
+  print('/');
+  print(length);
+  printCRLF();
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::httpSuccessRange(const char *contentType, long length,
+                                       long *offset, long *count,
+                                       const char *extraHeaders)
+{
+  P(typeHeader) = "Content-Type: ";
+
+  RangeResult range = selectRange(length, offset, count);
+  printRangeStatus(range, *count);
+  printP(typeHeader);
+  print(contentType);
+  printCRLF();
+  printRangeHeaders(range, *offset, *count, length);
+  if (extraHeaders)
+    print(extraHeaders);
+  printCRLF();
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::httpSeeOther(const char *otherURL)
+{
+  P(seeOtherStatus) = "303 See Other";
+  P(seeOtherMsg) = "Location: ";
+
+  printStatus(seeOtherStatus, 0);
+  printP(seeOtherMsg);
+  print(otherURL);
+  printCRLF();
+  printCRLF();
+}
+
+WEBDUINO_TEMPLATE
+uint8_t WEBDUINO_SERVER::countSockets(uint8_t state)
+{
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < SLOTS; ++i)
+  {
+    if (m_conns[i].state == state)
+      ++count;
+  }
+  return count;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::httpUnavailable()
+{
+  P(busyStatus) = "503 Service Unavailable";
+
+  printStatus(busyStatus, 0);
+  printCRLF();
+}
+
+// Answer a request whose content we can't find the end of, with a bad
+// Content-Length or a Transfer-Encoding, without reading any of it.
+// The connection is closed afterwards.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::rejectContent(uint8_t body)
+{
+  P(codedStatus) = "501 Not Implemented";
+
+  m_readingContent = false;
+  m_contentLength = 0;
+  if (body & WEBDUINO_BODY_BAD)
+    httpFail();
+  else
+  {
+    printStatus(codedStatus, 0);
+    printCRLF();
+  }
+}
+
+// CacheEntry::flags: the first two say which headers the response was
+// sent with, which must match the request for it to be sent again
+#define WEBDUINO_CACHE_KEEP_ALIVE 0x01
+#define WEBDUINO_CACHE_HTTP11     0x02
+#define WEBDUINO_CACHE_PERSIST    0x04  // the connection was kept open
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::setCache(char *buffer, size_t size)
+{
+  WEBDUINO_REQUIRE(CACHE);
+  m_cache = (uint8_t *)buffer;
+  m_cacheSize = size;
+  m_cacheFill = 0;
+  m_cacheEnd = 0;
+  m_caching = false;
+}
+
+// The flags a response to this request would be kept with, apart from
+// WEBDUINO_CACHE_PERSIST.
+WEBDUINO_TEMPLATE
+uint8_t WEBDUINO_SERVER::cacheFlags()
+{
+  return (m_keepAlive ? WEBDUINO_CACHE_KEEP_ALIVE : 0) |
+    (m_http11 ? WEBDUINO_CACHE_HTTP11 : 0);
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::cachedResponse(unsigned long maxAge)
+{
+  // a MEASURE command calls this again when it's run the second time,
+  // and the response to a Range header depends on more than the URL
+  if (!WEBDUINO_HAS(CACHE) || m_cache == NULL || m_caching ||
+      m_command == NULL ||
+      m_requestType != GET || m_rangeFirst >= 0 || m_rangeLast >= 0)
+    return false;
+  size_t tailLength = strlen(m_commandTail);
+  if (tailLength > 255)
+    return false;
+
+  unsigned long now = millis();
+  uint8_t flags = cacheFlags();
+  size_t pos = 0;
+  while (pos < m_cacheFill)
+  {
+    CacheEntry entry;
+    memcpy(&entry, m_cache + pos, sizeof(entry));
+    const uint8_t *tail = m_cache + pos + sizeof(entry);
+    if (now - entry.sent >= entry.maxAge)
+      dropCacheEntry(pos);
+    else if (entry.cmd == m_command &&
+             (entry.flags & ~WEBDUINO_CACHE_PERSIST) == flags &&
+             entry.tailLength == tailLength &&
+             memcmp(tail, m_commandTail, tailLength) == 0)
+    {
+      flush();
+      waitToSend(entry.length);
+      m_client.write(tail + tailLength, entry.length);
+      m_sent += entry.length;
+      m_persist = (entry.flags & WEBDUINO_CACHE_PERSIST) != 0;
+      return true;
+    }
+    else
+      pos += sizeof(entry) + entry.tailLength + entry.length;
+  }
+
+  // keep what the command sends from here on, with the length and time
+  // filled in once it's finished
+  CacheEntry entry;
+  entry.cmd = m_command;
+  entry.sent = 0;
+  entry.maxAge = maxAge;
+  entry.length = 0;
+  entry.tailLength = tailLength;
+  entry.flags = flags;
+  m_caching = true;
+  cacheOutput((const uint8_t *)&entry, sizeof(entry));
+  cacheOutput((const uint8_t *)m_commandTail, tailLength);
+  return false;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::invalidateCache(Command *cmd)
+{
+  size_t pos = 0;
+  while (WEBDUINO_HAS(CACHE) && pos < m_cacheFill)
+  {
+    CacheEntry entry;
+    memcpy(&entry, m_cache + pos, sizeof(entry));
+    if (cmd == NULL || entry.cmd == cmd)
+      dropCacheEntry(pos);
+    else
+      pos += sizeof(entry) + entry.tailLength + entry.length;
+  }
+}
+
+// Add to the response being kept, dropping the oldest entries to make
+// room.  A response that won't fit even in an empty cache isn't kept.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::cacheOutput(const uint8_t *data, size_t length)
+{
+  while (m_cacheEnd + length > m_cacheSize && m_cacheFill > 0)
+    dropCacheEntry(0);
+  if (m_cacheEnd + length > m_cacheSize)
+  {
+    m_caching = false;
+    m_cacheEnd = m_cacheFill;
+    return;
+  }
+  memcpy(m_cache + m_cacheEnd, data, length);
+  m_cacheEnd += length;
+}
+
+// Remove the entry at pos, moving those after it, and any response
+// being kept, down.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::dropCacheEntry(size_t pos)
+{
+  CacheEntry entry;
+  memcpy(&entry, m_cache + pos, sizeof(entry));
+  size_t size = sizeof(entry) + entry.tailLength + entry.length;
+  memmove(m_cache + pos, m_cache + pos + size, m_cacheEnd - pos - size);
+  m_cacheFill -= size;
+  m_cacheEnd -= size;
+}
+
+// The response being kept has been sent, so make it an entry.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::finishCache()
+{
+  m_caching = false;
+  // an event stream or WebSocket isn't over, and can't be repeated
+  if (WEBDUINO_HAS(BROADCAST) && m_switchState != PS_CLOSED)
+  {
+    m_cacheEnd = m_cacheFill;
+    return;
+  }
+
+  CacheEntry entry;
+  memcpy(&entry, m_cache + m_cacheFill, sizeof(entry));
+  entry.sent = millis();
+  entry.length = m_cacheEnd - m_cacheFill - sizeof(entry) - entry.tailLength;
+  if (m_persist)
+    entry.flags |= WEBDUINO_CACHE_PERSIST;
+  memcpy(m_cache + m_cacheFill, &entry, sizeof(entry));
+  m_cacheFill = m_cacheEnd;
+}
+
+#if WEBDUINO_METRICS
+WEBDUINO_TEMPLATE
+const typename WEBDUINO_SERVER::RouteStats *
+WEBDUINO_SERVER::routeStats(uint8_t index)
+{
+  if (index >= SIZE(m_stats) ||
+      (index >= STATS_COMMANDS && m_stats[index].cmd == NULL))
+    return NULL;
+  m_stats[STATS_FAILURE].cmd = m_failureCmd;
+  m_stats[STATS_DEFAULT].cmd = m_defaultCmd;
+  return &m_stats[index];
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::resetStats()
+{
+  // keep the commands in the same places
+  for (uint8_t i = 0; i < SIZE(m_stats); ++i)
+  {
+    Command *cmd = m_stats[i].cmd;
+    memset(&m_stats[i], 0, sizeof(m_stats[i]));
+    m_stats[i].cmd = cmd;
+  }
+}
+
+// Add the request that's just been answered to its command's counters.
+// started is micros() and sent m_sent when its headers were complete.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::countRequest(Connection &conn, unsigned long started,
+                                   unsigned long sent, bool tail_complete)
+{
+  RouteStats *stats = m_routeStats;
+  unsigned long received = conn.received;
+  m_routeStats = NULL;
+  conn.received = 0;
+  if (stats == NULL)
+    return;
+
+  ++stats->requests;
+  stats->bytesIn += received;
+  stats->bytesOut += m_sent - sent;
+  if (m_incidents & WEBDUINO_INCIDENT_TIMEOUT)
+    ++stats->timeouts;
+  else if (m_incidents & WEBDUINO_INCIDENT_DROP)
+    ++stats->drops;
+  if (!tail_complete)
+    ++stats->truncated;
+
+  // each bucket covers four times the time of the one before
+  unsigned long elapsed = (micros() - started) >> 8;
+  uint8_t bucket = 0;
+  while (elapsed != 0 && bucket < SIZE(stats->latency) - 1)
+  {
+    elapsed >>= 2;
+    ++bucket;
+  }
+  ++stats->latency[bucket];
+}
+
+// Answer WEBDUINO_STATUS_URL with a line of counters for each command.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::sendStatus(ConnectionType type)
+{
+  P(heading) = "# command requests in out timeouts drops truncated "
+    "overflows <256us <1ms <4ms <16ms <64ms <256ms <1s more" CRLF;
+  P(failureName) = "(failure)";
+  P(defaultName) = "(default)";
+  P(builtinName) = "(built-in)";
+  P(commandName) = "(command)";
+
+  httpSuccess("text/plain", NULL, CHUNKED);
+  if (type == HEAD)
+    return;
+
+  printP(heading);
+  const RouteStats *stats;
+  for (uint8_t i = 0; (stats = routeStats(i)) != NULL; ++i)
+  {
+    // name it by its URL where we can
+    const char *verb = NULL;
+    const prog_uchar *path = commandName;
+    if (i == STATS_FAILURE)
+      path = failureName;
+    else if (i == STATS_DEFAULT)
+      path = defaultName;
+    else if (i == STATS_BUILTIN)
+      path = builtinName;
+    else
+    {
+      for (uint8_t c = 0; c < m_cmdCount; ++c)
+        if (m_commands[c].cmd == stats->cmd)
+          verb = m_commands[c].verb;
+      for (uint8_t r = 0;
+           WEBDUINO_HAS(ROUTES) && verb == NULL && r < m_routeCount; ++r)
+        if ((Command *)pgm_read_ptr(&m_routes[r].cmd) == stats->cmd)
+          path = (const prog_uchar *)pgm_read_ptr(&m_routes[r].path);
+    }
+    if (verb)
+      print(verb);
+    else
+      printP(path);
+
+    unsigned long counts[] = { stats->requests, stats->bytesIn,
+                               stats->bytesOut, stats->timeouts,
+                               stats->drops, stats->truncated,
+                               stats->overflows };
+    for (uint8_t n = 0; n < SIZE(counts); ++n)
+    {
+      print(' ');
+      print(counts[n]);
+    }
+    for (uint8_t n = 0; n < SIZE(stats->latency); ++n)
+    {
+      print(' ');
+      print(stats->latency[n]);
+    }
+    printCRLF();
+  }
+}
+#endif
+
+#if WEBDUINO_TRACE
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::setTraceOutput(Print *out)
+{
+  m_traceOut = out;
+}
+
+// Add an event to the ring, over the oldest if it's full.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::trace(uint8_t event, uint8_t sock, uint16_t arg)
+{
+  TraceEvent &e = m_trace[m_traceHead];
+  e.time = micros();
+  e.event = event;
+  e.sock = sock;
+  e.arg = arg;
+  if (++m_traceHead == WEBDUINO_TRACE)
+    m_traceHead = 0;
+  if (m_traceCount < WEBDUINO_TRACE)
+    ++m_traceCount;
+  else if (m_traceLost < 0xffff)
+    ++m_traceLost;
+}
+
+WEBDUINO_TEMPLATE
+uint16_t WEBDUINO_SERVER::dumpTrace(Print &out, uint16_t max)
+{
+  uint16_t written = 0;
+  for (; written < max && m_traceCount > 0; ++written)
+  {
+    uint16_t oldest = (m_traceHead + WEBDUINO_TRACE - m_traceCount) %
+      WEBDUINO_TRACE;
+    TraceEvent e = m_trace[oldest];
+    if (m_traceLost)
+    {
+      // say how many went missing before this one
+      e.event = WEBDUINO_TRACE_LOST;
+      e.sock = 0;
+      e.arg = m_traceLost;
+      m_traceLost = 0;
+    }
+    else
+      --m_traceCount;
+
+    out.print("~ ");
+    out.print(e.time, HEX);
+    out.print(' ');
+    out.print((unsigned long)e.event, HEX);
+    out.print(' ');
+    out.print((unsigned long)e.sock, HEX);
+    out.print(' ');
+    out.print((unsigned long)e.arg, HEX);
+    out.println();
+  }
+  return written;
+}
+
+// Answer WEBDUINO_TRACE_URL with the events in the ring.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::sendTrace(ConnectionType type)
+{
+  httpSuccess("text/plain", NULL, CHUNKED);
+  // only as many as there are now, not the ones this adds
+  if (type != HEAD)
+    dumpTrace(*this, m_traceCount + (m_traceLost ? 1 : 0));
+}
+#endif
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::httpEventStream(uint8_t channel)
+{
+  P(successStatus) = "200 OK";
+  P(eventHeaders) =
+    "Content-Type: text/event-stream" CRLF
+    "Cache-Control: no-cache" CRLF
+    CRLF;
+
+  WEBDUINO_REQUIRE(EVENTS);
+  if (countSockets(PS_EVENTS) >= WEBDUINO_EVENT_STREAMS)
+  {
+    httpUnavailable();
+    return false;
+  }
+
+  // the stream only ends when the connection does
+  printStatus(successStatus, -1);
+  printP(eventHeaders);
+  if (m_requestType != HEAD)
+  {
+    m_conn->channel = channel;
+    m_switchState = PS_EVENTS;
+  }
+  return true;
+}
+
+WEBDUINO_TEMPLATE
+uint8_t WEBDUINO_SERVER::eventStreams(uint8_t channel)
+{
+  uint8_t streams = 0;
+  for (uint8_t i = 0; WEBDUINO_HAS(EVENTS) && i < SLOTS; ++i)
+  {
+    if (m_conns[i].state == PS_EVENTS && m_conns[i].channel == channel)
+      ++streams;
+  }
+  return streams;
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::beginEvent(const char *event, uint8_t channel)
+{
+  P(eventField) = "event: ";
+  P(dataField) = "data: ";
+
+  uint8_t socks = 0;
+  for (uint8_t i = 0; WEBDUINO_HAS(EVENTS) && i < SLOTS; ++i)
+  {
+    if (m_conns[i].state == PS_EVENTS && m_conns[i].channel == channel)
+      socks |= 1 << m_conns[i].sock;
+  }
+  if (!WEBDUINO_HAS(EVENTS) || !beginBroadcast(socks, false, 0))
+    return false;
+
+  if (event)
+  {
+    printP(eventField);
+    print(event);
+    write('\n');
+  }
+  printP(dataField);
+  return true;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::endEvent()
+{
+  if (!WEBDUINO_HAS(EVENTS) || !m_broadcast)
+    return;
+
+  // a blank line ends the event
+  write((const uint8_t *)"\n\n", 2);
+  endBroadcast();
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::sendEvent(const char *data, const char *event,
+                                uint8_t channel)
+{
+  if (!beginEvent(event, channel))
+    return false;
+  print(data);
+  endEvent();
+  return true;
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::enableWebSockets()
+{
+  P(socketKeyHeader) = "sec-websocket-key";
+
+  WEBDUINO_REQUIRE(WEBSOCKETS);
+  for (uint8_t i = 0; i < m_captureCount; ++i)
+  {
+    if (m_captureNames[i] == socketKeyHeader)
+      return true;
+  }
+  return captureHeader(socketKeyHeader, m_socketKey, sizeof(m_socketKey));
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::httpWebSocket(SocketCommand *cmd)
+{
+  P(switchingStatus) =
+    "HTTP/1.1 101 Switching Protocols" CRLF
+    WEBDUINO_SERVER_HEADER
+    "Upgrade: websocket" CRLF
+    "Connection: Upgrade" CRLF
+    "Sec-WebSocket-Accept: ";
+  P(upgradeStatus) = "426 Upgrade Required";
+  P(versionHeader) = "Sec-WebSocket-Version: 13" CRLF CRLF;
+
+  WEBDUINO_REQUIRE(WEBSOCKETS);
+  uint8_t upgrade = m_conn->upgrade;
+  if (m_requestType != GET || strlen(m_socketKey) != 24 ||
+      !(upgrade & WEBDUINO_UPGRADE_CONNECTION) ||
+      !(upgrade & WEBDUINO_UPGRADE_WEBSOCKET))
+  {
+    httpFail();
+    return false;
+  }
+  if (!(upgrade & WEBDUINO_UPGRADE_VERSION))
+  {
+    // say which version we do speak
+    printStatus(upgradeStatus, 0);
+    printP(versionHeader);
+    return false;
+  }
+  if (countSockets(PS_WEBSOCKET) >= WEBDUINO_WEBSOCKETS)
+  {
+    httpUnavailable();
+    return false;
+  }
+
+  char accept[29];
+  webduinoWebSocketAccept(m_socketKey, accept);
+  printP(switchingStatus);
+  print(accept);
+  printCRLF();
+  printCRLF();
+  m_conn->socketCmd = cmd;
+  m_switchState = PS_WEBSOCKET;
+  return true;
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::beginMessage(SocketCommand *cmd, bool binary)
+{
+  uint8_t socks = 0;
+  if (!WEBDUINO_HAS(WEBSOCKETS))
+    return false;
+  if (cmd == NULL)
+  {
+    if (m_socketCall && m_conn->state == PS_WEBSOCKET)
+      socks = 1 << m_sock;
+  }
+  else
+  {
+    for (uint8_t i = 0; i < SLOTS; ++i)
+    {
+      if (m_conns[i].state == PS_WEBSOCKET && m_conns[i].socketCmd == cmd)
+        socks |= 1 << m_conns[i].sock;
+    }
+  }
+  return beginBroadcast(socks, true,
+                        binary ? WEBDUINO_WS_BINARY : WEBDUINO_WS_TEXT);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::endMessage()
+{
+  if (!WEBDUINO_HAS(WEBSOCKETS) || !m_broadcast)
+    return;
+
+  m_frameOp |= WEBDUINO_WS_FIN;
+  endBroadcast();
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::sendMessage(const char *text, SocketCommand *cmd)
+{
+  if (!beginMessage(cmd))
+    return false;
+  print(text);
+  endMessage();
+  return true;
+}
+
+// Start sending to the sockets in socks that have room for at least a
+// bufferful, for beginEvent() and beginMessage().  framed output is
+// sent as WebSocket frames, the first with opcode frameOp.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::beginBroadcast(uint8_t socks, bool framed,
+                                     uint8_t frameOp)
+{
+  // a measured command is run twice, so only send during the second run
+  if (m_broadcast || m_measure == MEASURE_COUNTING)
+    return false;
+
+  for (uint8_t sock = 0; sock < MAX_SOCK_NUM; ++sock)
+  {
+    if ((socks & (1 << sock)) &&
+        (WEBDUINO_SOCK_TX_FREE(sock) < sizeof(m_buffer) || ponging(sock)))
+      socks &= ~(1 << sock);
+  }
+  if (socks == 0)
+    return false;
+
+  // send what a command has printed so far, then borrow the output
+  // buffer, dropping the empty chunk flush() starts
+  flush();
+  m_broadcastChunked = m_chunked;
+  if (m_chunked)
+    m_bufFill = m_chunkStart;
+  m_chunked = false;
+  m_bufLimit = sizeof(m_buffer);
+  m_broadcast = true;
+  m_broadcastSocks = socks;
+  m_framed = framed;
+  m_frameOp = frameOp;
+  if (framed)
+    m_bufFill = WEBDUINO_WS_SEND_HEADER;
+  return true;
+}
+
+// Send the end of an event or message and give the output buffer back
+// to the response it was borrowed from.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::endBroadcast()
+{
+  flush();
+  m_bufFill = 0;
+  m_broadcast = false;
+  m_broadcastSocks = 0;
+  m_framed = false;
+
+  // tell the commands of WebSockets that were dropped, now that the
+  // output buffer is free for them to send with
+  if (WEBDUINO_HAS(WEBSOCKETS) && m_droppedConns)
+  {
+    uint8_t sock = m_sock;
+    Connection *conn = m_conn;
+    Client client = m_client;
+    uint8_t dropped = m_droppedConns;
+    m_droppedConns = 0;
+    for (uint8_t i = 0; i < SLOTS; ++i)
+    {
+      if (dropped & (1 << i))
+        socketClosed(m_conns[i]);
+    }
+    m_sock = sock;
+    m_conn = conn;
+    m_client = client;
+  }
+
+  if (m_broadcastChunked)
+  {
+    m_chunked = true;
+    m_bufLimit = sizeof(m_buffer) - 2;
+    openChunk();
+  }
+}
+
+// Send the output buffer to each socket getting the current event or
+// message, as a frame of its own for a WebSocket.  A browser without
+// room for it would have to be waited for, and once it has missed part
+// of an event it can't make sense of the rest of the stream, so it's
+// closed; browsers reconnect to event streams by themselves.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::flushBroadcast()
+{
+  uint8_t *data = m_buffer;
+  size_t length = m_bufFill;
+  if (m_framed)
+  {
+    size_t payload = m_bufFill - WEBDUINO_WS_SEND_HEADER;
+    if (payload == 0 && !(m_frameOp & WEBDUINO_WS_FIN))
+      return;
+
+    // the shortest header that will do, ending where the payload starts
+    if (payload <= 125)
+    {
+      data += 2;
+      data[1] = payload;
+    }
+    else
+    {
+      data[1] = 126;
+      data[2] = payload >> 8;
+      data[3] = payload & 0xff;
+    }
+    data[0] = m_frameOp;
+    length = m_buffer + m_bufFill - data;
+    // the rest of the message follows in continuation frames
+    m_frameOp = WEBDUINO_WS_CONTINUATION;
+  }
+
+  unsigned long now = millis();
+  for (uint8_t sock = 0; sock < MAX_SOCK_NUM; ++sock)
+  {
+    if (!(m_broadcastSocks & (1 << sock)))
+      continue;
+    Connection *conn = connection(sock);
+    uint8_t state = conn ? conn->state : (uint8_t)PS_CLOSED;
+    if ((state != PS_EVENTS && state != PS_WEBSOCKET) ||
+        WEBDUINO_SOCK_TX_FREE(sock) < length)
+    {
+      if (state == PS_EVENTS || state == PS_WEBSOCKET)
+        stopSocket(sock);
+      if (WEBDUINO_HAS(WEBSOCKETS) && state == PS_WEBSOCKET)
+        m_droppedConns |= 1 << (conn - m_conns);
+      m_broadcastSocks &= ~(1 << sock);
+      continue;
+    }
+    Client(sock).write(data, length);
+    conn->lastActive = now;
+  }
+  m_bufFill = m_framed ? WEBDUINO_WS_SEND_HEADER : 0;
+}
+
+// Read whatever has arrived on a WebSocket, passing messages to its
+// command and answering pings and closes, without waiting for more.
+// The payload of a frame is unmasked where it lies in the input buffer
+// and handed on from there.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::readWebSocket(Connection &conn)
+{
+  uint8_t *header = (uint8_t *)conn.urlBuffer;
+
+  while (conn.state == PS_WEBSOCKET)
+  {
+    if (m_rxHead == m_rxTail && readAvailable() == 0)
+      return;
+    conn.lastActive = millis();
+
+    if (conn.frameFill != WEBDUINO_WS_PAYLOAD)
+    {
+      header[conn.frameFill++] = m_rxBuffer[m_rxHead++];
+      if (conn.frameFill == webduinoFrameHeaderLength(header, conn.frameFill))
+      {
+        startFrame(conn);
+        if (conn.state == PS_WEBSOCKET && conn.frameLeft == 0)
+          endFrame(conn);
+      }
+      continue;
+    }
+
+    size_t length = m_rxTail - m_rxHead;
+    if ((long)length > conn.frameLeft)
+      length = conn.frameLeft;
+    uint8_t *data = m_rxBuffer + m_rxHead;
+    for (size_t i = 0; i < length; ++i)
+      data[i] ^= header[i & 3];
+    m_rxHead += length;
+    conn.frameLeft -= length;
+
+    // turn the mask so that it starts with the key for the next byte
+    uint8_t turn = length & 3;
+    if (turn)
+    {
+      uint8_t mask[4];
+      memcpy(mask, header, 4);
+      for (uint8_t i = 0; i < 4; ++i)
+        header[i] = mask[(i + turn) & 3];
+    }
+
+    framePayload(conn, (const char *)data, length);
+    if (conn.state == PS_WEBSOCKET && conn.frameLeft == 0)
+      endFrame(conn);
+  }
+}
+
+// A frame's header has been read into the connection's URL buffer.
+// Check it, and leave its masking key at the start of the buffer.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::startFrame(Connection &conn)
+{
+  uint8_t *header = (uint8_t *)conn.urlBuffer;
+  uint8_t op = header[0] & 0x0f;
+  bool fin = (header[0] & WEBDUINO_WS_FIN) != 0;
+  long length = header[1] & 0x7f;
+
+  // no extensions were agreed, and browsers must mask what they send
+  if ((header[0] & 0x70) || !(header[1] & 0x80))
+  {
+    closeWebSocket(conn, WEBDUINO_WS_PROTOCOL_ERROR);
+    return;
+  }
+  if (length == 126)
+    length = ((long)header[2] << 8) | header[3];
+  else if (length == 127)
+  {
+    // nothing on an Arduino needs a frame anything like 2GB long
+    if (header[2] | header[3] | header[4] | header[5] | (header[6] & 0x80))
+    {
+      closeWebSocket(conn, WEBDUINO_WS_TOO_BIG);
+      return;
+    }
+    length = ((long)header[6] << 24) | ((long)header[7] << 16) |
+      ((long)header[8] << 8) | header[9];
+  }
+  memmove(header, header + conn.frameFill - 4, 4);
+  conn.frameOp = (fin ? WEBDUINO_WS_FIN : 0) | op;
+  conn.frameLeft = length;
+  conn.frameFill = WEBDUINO_WS_PAYLOAD;
+
+  if (op & 0x08)
+  {
+    // control frames are short, can't be split and may come between
+    // the frames of a message
+    if (!fin || length > 125 || op > WEBDUINO_WS_PONG ||
+        (op == WEBDUINO_WS_CLOSE && length == 1))
+      closeWebSocket(conn, WEBDUINO_WS_PROTOCOL_ERROR);
+    else if (op == WEBDUINO_WS_PING)
+    {
+      // the pong goes back with the ping's data as it arrives
+      write(WEBDUINO_WS_FIN | WEBDUINO_WS_PONG);
+      write(length);
+    }
+  }
+  else if (op == WEBDUINO_WS_CONTINUATION ? conn.messageOp == 0 :
+           (conn.messageOp != 0 || op > WEBDUINO_WS_BINARY))
+    closeWebSocket(conn, WEBDUINO_WS_PROTOCOL_ERROR);
+  else if (op != WEBDUINO_WS_CONTINUATION)
+    conn.messageOp = op;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::framePayload(Connection &conn, const char *data,
+                                   size_t length)
+{
+  switch (conn.frameOp & 0x0f)
+  {
+  case WEBDUINO_WS_PING:
+    write((const uint8_t *)data, length);
+    flush();
+    break;
+
+  case WEBDUINO_WS_CLOSE:
+  case WEBDUINO_WS_PONG:
+    break;
+
+  default:
+    callSocket(conn, conn.messageOp == WEBDUINO_WS_TEXT ?
+               SOCKET_TEXT : SOCKET_BINARY, data, length);
+    break;
+  }
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::endFrame(Connection &conn)
+{
+  uint8_t op = conn.frameOp & 0x0f;
+
+  conn.frameFill = 0;
+  if (op == WEBDUINO_WS_PING)
+    flush();
+  else if (op == WEBDUINO_WS_CLOSE)
+    closeWebSocket(conn, WEBDUINO_WS_NORMAL);
+  else if (!(op & 0x08) && (conn.frameOp & WEBDUINO_WS_FIN))
+  {
+    conn.messageOp = 0;
+    callSocket(conn, SOCKET_END, NULL, 0);
+  }
+}
+
+// Send a close frame with status, close the connection and tell its
+// command.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::closeWebSocket(Connection &conn, uint16_t status)
+{
+  write(WEBDUINO_WS_FIN | WEBDUINO_WS_CLOSE);
+  write(2);
+  write(status >> 8);
+  write(status & 0xff);
+  flush();
+  stopSocket(m_sock);
+  callSocket(conn, SOCKET_CLOSE, NULL, 0);
+}
+
+// Whether sock is part way through reading a ping, whose pong has been
+// partly sent, so that nothing else can be sent to it yet.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::ponging(uint8_t sock)
+{
+  Connection *conn = connection(sock);
+  return WEBDUINO_HAS(WEBSOCKETS) && conn && conn->state == PS_WEBSOCKET &&
+    conn->frameFill == WEBDUINO_WS_PAYLOAD &&
+    (conn->frameOp & 0x0f) == WEBDUINO_WS_PING;
+}
+
+// Tell the command of a WebSocket whose socket has closed.  Its
+// connection is free, but still has the command in it.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::socketClosed(Connection &conn)
+{
+  m_sock = conn.sock;
+  m_conn = &conn;
+  m_client = Client(m_sock);
+  callSocket(conn, SOCKET_CLOSE, NULL, 0);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::callSocket(Connection &conn, SocketEvent event,
+                                 const char *data, size_t length)
+{
+  if (!WEBDUINO_HAS(WEBSOCKETS))
+    return;
+  m_socketCall = true;
+  conn.socketCmd(*this, event, data, length);
+  m_socketCall = false;
+}
+
+// Append whatever the Ethernet library has ready to m_rxBuffer, as far
+// as there's room and without reading past the end of the POST
+// content.  Returns the number of bytes added, without waiting.
+WEBDUINO_TEMPLATE
+size_t WEBDUINO_SERVER::readAvailable()
+{
+  if (m_rxHead == m_rxTail)
+    m_rxHead = m_rxTail = 0;
+
+  int avail = m_client.available();
+  size_t room = sizeof(m_rxBuffer) - m_rxTail;
+  if (m_readingContent)
+  {
+    long left = m_contentLength - (long)(m_rxTail - m_rxHead);
+    if (left <= 0)
+      return 0;
+    if ((long)room > left)
+      room = left;
+  }
+  if (avail <= 0)
+    return 0;
+  if ((size_t)avail > room)
+    avail = room;
+
+  for (int i = 0; i < avail; ++i)
+  {
+    int ch = m_client.read();
+#if WEBDUINO_SERIAL_DEBUGGING
+    if (ch == '\r')
+      Serial.print("<CR>");
+    else if (ch == '\n')
+      Serial.println("<LF>");
+    else
+      Serial.print((char)ch);
+#endif
+    m_rxBuffer[m_rxTail++] = ch;
+  }
+#if WEBDUINO_METRICS
+  m_conn->received += avail;
+#endif
+  return avail;
+}
+
+// Make sure at least want bytes are waiting in m_rxBuffer, pulling
+// everything the Ethernet library has ready in one go.  Returns false
+// if the client goes away, stops sending for longer than
+// WEBDUINO_READ_TIMEOUT_IN_MS, or we've reached the end of the POST
+// content before that many bytes arrived.  While the request line and
+// headers are read, request is true and the whole request has
+// WEBDUINO_REQUEST_TIMEOUT_IN_MS, after which the browser is told so.
+// The body then has WEBDUINO_BODY_TIMEOUT_IN_MS, and the browser is
+// told too unless the command has started answering.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::fillBuffer(size_t want, bool request)
+{
+  size_t buffered = m_rxTail - m_rxHead;
+  if (buffered >= want)
+    return true;
+  if (want > sizeof(m_rxBuffer))
+    return false;
+
+  // stop reading the socket early if we get to content-length
+  // characters in the POST.  This is because some clients leave
+  // the socket open because they assume HTTP keep-alive.
+  if (m_readingContent && (long)buffered >= m_contentLength)
+  {
+#if WEBDUINO_SERIAL_DEBUGGING > 1
+    Serial.println("\n*** End of content, terminating connection");
+#endif
+    return false;
+  }
+
+  // slide the unread bytes down to make room at the end
+  if (m_rxHead > 0)
+  {
+    memmove(m_rxBuffer, m_rxBuffer + m_rxHead, buffered);
+    m_rxHead = 0;
+    m_rxTail = buffered;
+  }
+
+  // times are compared by subtracting, which still works when
+  // millis() wraps around to 0
+  unsigned long lastData = millis();
+
+  while (m_client.connected())
+  {
+    unsigned long now = millis();
+    unsigned long spent = now - m_conn->started;
+    bool late = request ? spent >= WEBDUINO_REQUEST_TIMEOUT_IN_MS :
+      m_readingContent && spent >= WEBDUINO_BODY_TIMEOUT_IN_MS;
+    if (!late && readAvailable() > 0)
+    {
+      if (m_rxTail >= want)
+        return true;
+      if (m_readingContent && (long)m_rxTail >= m_contentLength)
+        return false;
+
+      lastData = now;
+    }
+    else if (late || now - lastData >= WEBDUINO_READ_TIMEOUT_IN_MS)
+    {
+      // connection timed out, destroy client, return EOF
+#if WEBDUINO_SERIAL_DEBUGGING
+      Serial.println("*** Connection timed out");
+#endif
+#if WEBDUINO_METRICS
+      m_incidents |= WEBDUINO_INCIDENT_TIMEOUT;
+#endif
+      WEBDUINO_TRACE_EVENT(WEBDUINO_TRACE_TIMEOUT, m_sock, m_conn->state);
+      m_client.flush();
+      if (request || (late && m_sent == m_contentSent && m_bufFill == 0))
+        sendTimeout();
+      flush();
+      stopSocket(m_sock);
+      m_client = Client(MAX_SOCK_NUM);
+      return false;
+    }
+    else if (m_idleCmd)
+      m_idleCmd(*this);
+  }
+
+  // connection lost, return EOF
+#if WEBDUINO_SERIAL_DEBUGGING
+  Serial.println("*** Connection lost");
+#endif
+#if WEBDUINO_METRICS
+  m_incidents |= WEBDUINO_INCIDENT_DROP;
+#endif
+  WEBDUINO_TRACE_EVENT(WEBDUINO_TRACE_HANGUP, m_sock, m_conn->state);
+  return false;
+}
+
+// Answer a request that took too long to arrive with "408 Request
+// Timeout", before the connection is closed.  Nothing else is being
+// sent while a request is read.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::sendTimeout()
+{
+  P(timeoutStatus) = "408 Request Timeout";
+
+  m_keepAlive = false;
+  printStatus(timeoutStatus, 0);
+  printCRLF();
+  flush();
+}
+
+// Let the idle command run until the Ethernet chip has room for length
+// more bytes for the client, instead of the Ethernet library spinning
+// in Client::write() until it has.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::waitToSend(size_t length)
+{
+  if (m_idleCmd == NULL)
+    return;
+  if (length > WEBDUINO_SOCK_TX_SIZE)
+    length = WEBDUINO_SOCK_TX_SIZE;
+  while (WEBDUINO_SOCK_TX_FREE(m_sock) < length && m_client.connected())
+    m_idleCmd(*this);
+}
 
-    // connection lost, return EOF
-#if WEBDUINO_SERIAL_DEBUGGING
-    Serial.println("*** Connection lost");
-#endif
+WEBDUINO_TEMPLATE
+int WEBDUINO_SERVER::read()
+{
+  if (m_client == NULL)
     return -1;
-  }
-  else
-    return m_pushback[--m_pushbackDepth];
+
+  if (m_readingContent && m_contentLength == 0)
+    return -1;
+
+  if (m_rxHead == m_rxTail && !fillBuffer(1))
+    return -1;
+
+  if (m_readingContent)
+    --m_contentLength;
+  return m_rxBuffer[m_rxHead++];
+}
+
+// Point *data at the POST content waiting in m_rxBuffer, reading more
+// from the client if there's none, and count up to max bytes of it as
+// read.  Returns how many bytes that is, which stay put until the next
+// read, or 0 at the end of the content or if the client stopped
+// sending.
+WEBDUINO_TEMPLATE
+size_t WEBDUINO_SERVER::readContent(const char **data, size_t max)
+{
+  if (m_readingContent && m_contentLength == 0)
+    return 0;
+
+  if (m_rxHead == m_rxTail && !fillBuffer(1))
+    return 0;
+
+  size_t length = m_rxTail - m_rxHead;
+  if (length > max)
+    length = max;
+  if (m_readingContent && (long)length > m_contentLength)
+    length = m_contentLength;
+  *data = (const char *)m_rxBuffer + m_rxHead;
+  m_rxHead += length;
+  if (m_readingContent)
+    m_contentLength -= length;
+  return length;
 }
 
-void WebServer::push(int ch)
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::push(int ch)
 {
   // don't allow pushing EOF
   if (ch == -1)
-    return;
+    return true;
 
-  m_pushback[m_pushbackDepth++] = ch;
-  // can't raise error here, so just replace last char over and over
-  if (m_pushbackDepth == SIZE(m_pushback))
-    m_pushbackDepth = SIZE(m_pushback) - 1;
+  if (m_rxHead == 0)
+  {
+    // nothing has been consumed from the front of the buffer, so
+    // shift what's there up one place if there's room
+    if (m_rxTail == sizeof(m_rxBuffer))
+      return false;
+    memmove(m_rxBuffer + 1, m_rxBuffer, m_rxTail);
+    ++m_rxTail;
+    ++m_rxHead;
+  }
+
+  m_rxBuffer[--m_rxHead] = ch;
+  if (m_readingContent)
+    ++m_contentLength;
+  return true;
 }
 
-void WebServer::reset()
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::reset()
 {
-  m_pushbackDepth = 0;
+  m_rxHead = 0;
+  m_rxTail = 0;
+  m_contentLength = 0;
+  m_contentTotal = 0;
+  m_readingContent = false;
+  m_keepAlive = false;
+  m_persist = false;
+  m_http11 = false;
+  m_chunked = false;
+  m_bufLimit = sizeof(m_buffer);
+  m_measure = MEASURE_OFF;
+  if (WEBDUINO_HAS(BROADCAST))
+    m_switchState = PS_CLOSED;
+  if (WEBDUINO_HAS(CACHE))
+  {
+    m_caching = false;
+    m_cacheEnd = m_cacheFill;
+    m_command = NULL;
+  }
+#if WEBDUINO_METRICS
+  m_routeStats = NULL;
+  m_incidents = 0;
+#endif
 }
 
-bool WebServer::expect(const char *str)
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::expect(const char *str)
 {
-  const char *curr = str;
-  while (*curr != 0)
+  // compare against the buffered input in place, only waiting for more
+  // data while everything seen so far matches
+  size_t i = 0;
+  while (str[i] != 0)
   {
-    int ch = read();
-    if (ch != *curr++)
-    {
-      // push back ch and the characters we accepted
-      push(ch);
-      while (--curr != str)
-        push(curr[-1]);
+    if (m_readingContent && (long)i >= m_contentLength)
       return false;
-    }
+    if (m_rxHead + i == m_rxTail && !fillBuffer(i + 1))
+      return false;
+    if (m_rxBuffer[m_rxHead + i] != (uint8_t)str[i])
+      return false;
+    ++i;
   }
+
+  m_rxHead += i;
+  if (m_readingContent)
+    m_contentLength -= i;
   return true;
 }
 
-bool WebServer::readInt(int &number)
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::readInt(int &number)
 {
   bool negate = false;
   bool gotNumber = false;
@@ -632,11 +4843,15 @@ bool WebServer::readInt(int &number)
   return gotNumber;
 }
 
-bool WebServer::readPOSTparam(char *name, int nameLen,
-                              char *value, int valueLen)
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::readPOSTparam(char *name, int nameLen,
+                                    char *value, int valueLen)
 {
   // assume name is at current place in stream
   int ch;
+#if WEBDUINO_METRICS
+  bool cut = false;
+#endif
 
   // clear out name and value so they'll be NUL terminated
   memset(name, 0, nameLen);
@@ -685,6 +4900,15 @@ bool WebServer::readPOSTparam(char *name, int nameLen,
       *value++ = ch;
       --valueLen;
     }
+#if WEBDUINO_METRICS
+    else if (!cut)
+    {
+      // no room for the rest of the value
+      cut = true;
+      if (m_routeStats)
+        ++m_routeStats->overflows;
+    }
+#endif
   }
 
   // if we get here, we hit the end-of-file, so POST is over and there
@@ -695,8 +4919,10 @@ bool WebServer::readPOSTparam(char *name, int nameLen,
 /* Retrieve a parameter that was encoded as part of the URL, stored in
  * the buffer pointed to by *tail.  tail is updated to point just past
  * the last character read from the buffer. */
-URLPARAM_RESULT WebServer::nextURLparam(char **tail, char *name, int nameLen,
-                                        char *value, int valueLen)
+WEBDUINO_TEMPLATE
+URLPARAM_RESULT WEBDUINO_SERVER::nextURLparam(char **tail, char *name,
+                                              int nameLen, char *value,
+                                              int valueLen)
 {
   // assume name is at current place in stream
   char ch, hex[3];
@@ -833,122 +5059,752 @@ URLPARAM_RESULT WebServer::nextURLparam(char **tail, char *name, int nameLen,
 
 
 
-// Read and parse the first line of the request header.
-// The "command" (GET/HEAD/POST) is translated into a numeric value in type.
-// The URL is stored in request,  up to the length passed in length
-// NOTE 1: length must include one byte for the terminating NUL.
-// NOTE 2: request is NOT checked for NULL,  nor length for a value < 1.
-// Reading stops when the code encounters a space, CR, or LF.  If the HTTP
-// version was supplied by the client,  it will still be waiting in the input
-// stream when we exit.
-//
-// On return, length contains the amount of space left in request.  If it's
-// less than 0,  the URL was longer than the buffer,  and part of it had to
-// be discarded.
+WEBDUINO_TEMPLATE
+typename WEBDUINO_SERVER::BodyResult
+WEBDUINO_SERVER::readBody(BodyCommand *cmd, void *context, char *buffer,
+                          size_t size)
+{
+  long offset = 0;
+  for (;;)
+  {
+    const char *data;
+    size_t length;
+    if (buffer)
+    {
+      size_t got;
+      length = 0;
+      while (length < size && (got = readContent(&data, size - length)) > 0)
+      {
+        memcpy(buffer + length, data, got);
+        length += got;
+      }
+      data = buffer;
+    }
+    else
+      length = readContent(&data);
+    if (length == 0)
+      break;
+
+    unsigned long busySince = millis();
+    while (length > 0)
+    {
+      int taken = cmd(*this, data, length, offset, context);
+      if (taken < 0 || (size_t)taken > length)
+        return BODY_STOPPED;
+      if (taken == 0)
+      {
+        // busy, so let the idle command have a turn before asking again
+        if (millis() - busySince >= WEBDUINO_READ_TIMEOUT_IN_MS)
+          return BODY_STOPPED;
+        if (m_idleCmd)
+          m_idleCmd(*this);
+        continue;
+      }
+      busySince = millis();
+      data += taken;
+      length -= taken;
+      offset += taken;
+    }
+  }
 
-void WebServer::getRequest(WebServer::ConnectionType &type,
-                           char *request, int *length)
+  return (m_readingContent && m_contentLength == 0) ?
+    BODY_COMPLETE : BODY_TRUNCATED;
+}
+
+WEBDUINO_TEMPLATE
+long WEBDUINO_SERVER::contentLength()
 {
-  --*length; // save room for NUL
+  return m_contentTotal;
+}
 
-  type = INVALID;
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::getHeaderParam(const char *header, const char *param,
+                                     char *value, int valueLen)
+{
+  int paramLen = strlen(param);
+  value[0] = 0;
 
-  // store the GET/POST line of the request
-  if (expect("GET "))
-    type = GET;
-  else if (expect("HEAD "))
-    type = HEAD;
-  else if (expect("POST "))
-    type = POST;
+  // parameters follow the first ";"
+  while ((header = strchr(header, ';')) != NULL)
+  {
+    ++header;
+    while (*header == ' ' || *header == '\t')
+      ++header;
+    if (strncasecmp(header, param, paramLen) != 0 || header[paramLen] != '=')
+      continue;
 
-  // if it doesn't start with any of those, we have an unknown method
-  // so just eat rest of header
+    header += paramLen + 1;
+    bool quoted = (*header == '"');
+    if (quoted)
+      ++header;
 
-  int ch;
-  while ((ch = read()) != -1)
+    int i = 0;
+    char ch;
+    while ((ch = *header++) != 0 &&
+           (quoted ? ch != '"' : ch != ';' && ch != ' '))
+    {
+      if (i == valueLen - 1)
+        return false;
+      value[i++] = ch;
+      value[i] = 0;
+    }
+    return true;
+  }
+  return false;
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::readMultipart(const char *contentType, PartCommand *cmd,
+                                    void *context)
+{
+  // parts are separated by CRLF, "--" and the boundary, except that the
+  // first one has nothing before it, so start as if the CRLF had just
+  // been read
+  char delim[4 + 70 + 1] = "\r\n--";
+  if (!getHeaderParam(contentType, "boundary", delim + 4, sizeof(delim) - 4) ||
+      delim[4] == 0)
+    return false;
+  uint8_t delimLen = strlen(delim);
+  uint8_t matched = 2;
+
+  enum { PREAMBLE, AFTER_DELIM, HEADERS, BODY } state = PREAMBLE;
+  uint8_t dashes = 0;
+  char line[WEBDUINO_PART_HEADER_SIZE];
+  uint8_t lineLen = 0;
+
+  const char *data;
+  size_t length;
+  while ((length = readContent(&data)) > 0)
   {
-    // stop storing at first space or end of line
-    if (ch == ' ' || ch == '\n' || ch == '\r')
+    // the part of data not yet passed on as part of a body
+    const char *run = NULL;
+
+    for (size_t i = 0; i < length; ++i)
     {
-      break;
+      char ch = data[i];
+      if (state == PREAMBLE || state == BODY)
+      {
+        if (ch == delim[matched])
+        {
+          // this could be the start of the boundary, so pass on the
+          // body up to here before it's certain
+          if (run)
+          {
+            if (!cmd(*this, PART_DATA, run, data + i - run, context))
+              return false;
+            run = NULL;
+          }
+          if (++matched < delimLen)
+            continue;
+
+          if (state == BODY && !cmd(*this, PART_END, NULL, 0, context))
+            return false;
+          state = AFTER_DELIM;
+          matched = 0;
+          dashes = 0;
+          continue;
+        }
+
+        if (matched > 0)
+        {
+          // it wasn't the boundary after all, so the bytes that looked
+          // like it were part of the body.  Only the first character of
+          // delim is a CR, so the match can only start again here.
+          if (state == BODY && !cmd(*this, PART_DATA, delim, matched, context))
+            return false;
+          matched = (ch == delim[0]) ? 1 : 0;
+          if (matched)
+            continue;
+        }
+
+        if (state == BODY && !run)
+          run = data + i;
+      }
+      else if (state == AFTER_DELIM)
+      {
+        // "--" after the boundary ends the body, CRLF starts a part
+        if (ch == '-' && ++dashes == 2)
+          return true;
+        if (ch == '\n')
+        {
+          state = HEADERS;
+          lineLen = 0;
+        }
+      }
+      else // HEADERS
+      {
+        if (ch == '\n')
+        {
+          if (lineLen > 0 && line[lineLen - 1] == '\r')
+            --lineLen;
+          line[lineLen] = 0;
+          if (lineLen == 0)
+            state = BODY;
+          else if (!cmd(*this, PART_HEADER, line, lineLen, context))
+            return false;
+          lineLen = 0;
+        }
+        else if (lineLen < sizeof(line) - 1)
+          line[lineLen++] = ch;
+      }
+    }
+
+    if (run && !cmd(*this, PART_DATA, run, data + length - run, context))
+      return false;
+  }
+
+  // the body ended before the last boundary
+  return false;
+}
+
+// The value of a hex digit, or -1 if ch isn't one
+static int webduinoHexDigit(char ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  ch |= 0x20;
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  return -1;
+}
+
+// Decode a URL parameter's name or value from *in to out, stopping at
+// the end of the string, at "&" or at stop, and end it with a NUL.
+// out may be the same as *in, as the decoded text is never longer.
+// *in is left at the character that stopped it, which is returned.
+// Inline so that sketches that never parse URL parameters don't get a
+// warning about it.
+static inline char webduinoDecodeParam(char **in, char *out, char stop, int *len)
+{
+  char *s = *in;
+  char *start = out;
+  char ch;
+  while ((ch = *s) != 0 && ch != '&' && ch != stop)
+  {
+    ++s;
+    if (ch == '+')
+      ch = ' ';
+    else if (ch == '%')
+    {
+      int high = webduinoHexDigit(s[0]);
+      int low = high < 0 ? -1 : webduinoHexDigit(s[1]);
+      if (low >= 0)
+      {
+        ch = (high << 4) | low;
+        s += 2;
+      }
+    }
+    *out++ = ch;
+  }
+  *out = 0;
+  *len = out - start;
+  *in = s;
+  return ch;
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::URLParams::parse(char *tail)
+{
+  char *in = tail;
+  char *out = tail;
+  count = 0;
+  while (*in)
+  {
+    if (count == WEBDUINO_URL_PARAMS_COUNT)
+      return false;
+
+    Param &param = params[count];
+    param.name = out;
+    char ch = webduinoDecodeParam(&in, out, '=', &param.nameLen);
+    out += param.nameLen + 1;
+    if (ch == '=')
+    {
+      ++in;
+      param.value = out;
+      ch = webduinoDecodeParam(&in, out, 0, &param.valueLen);
+      out += param.valueLen + 1;
+    }
+    else
+    {
+      param.value = param.name + param.nameLen;
+      param.valueLen = 0;
     }
-    if (*length > 0)
+    if (ch == '&')
+      ++in;
+
+    // skip empty pairs, as in "a=1&&b=2"
+    if (param.nameLen > 0 || param.valueLen > 0)
+      ++count;
+  }
+  return true;
+}
+
+WEBDUINO_TEMPLATE
+const char *WEBDUINO_SERVER::URLParams::get(const char *name) const
+{
+  int len = strlen(name);
+  for (uint8_t i = 0; i < count; ++i)
+  {
+    if (params[i].nameLen == len && memcmp(params[i].name, name, len) == 0)
+      return params[i].value;
+  }
+  return NULL;
+}
+
+WEBDUINO_TEMPLATE
+int WEBDUINO_SERVER::URLParams::getInt(const char *name, int otherwise) const
+{
+  const char *s = get(name);
+  if (s == NULL)
+    return otherwise;
+
+  bool negate = (*s == '-');
+  if (negate || *s == '+')
+    ++s;
+  if (*s < '0' || *s > '9')
+    return otherwise;
+
+  int number = 0;
+  while (*s >= '0' && *s <= '9')
+    number = number * 10 + (*s++ - '0');
+  if (*s != 0)
+    return otherwise;
+  return negate ? -number : number;
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::URLParams::getBool(const char *name,
+                                        bool otherwise) const
+{
+  const char *s = get(name);
+  if (s == NULL)
+    return otherwise;
+  return !(strcmp(s, "0") == 0 || strcasecmp(s, "false") == 0 ||
+           strcasecmp(s, "off") == 0 || strcasecmp(s, "no") == 0);
+}
+
+// Write n in decimal backwards from end, and return where it starts.
+// Once it's small enough, the rest is done in 16 bits, which an AVR
+// divides by 10 several times faster than 32.
+static char *webduinoFormatDecimal(char *end, unsigned long n)
+{
+  while (n > 0xffff)
+  {
+    *--end = '0' + n % 10;
+    n /= 10;
+  }
+  uint16_t rest = n;
+  do
+  {
+    *--end = '0' + rest % 10;
+    rest /= 10;
+  } while (rest > 0);
+  return end;
+}
+
+WEBDUINO_TEMPLATE
+WEBDUINO_SERVER::JsonWriter::JsonWriter(WebServerT &server) :
+  m_server(server),
+  m_depth(0),
+  m_objects(0),
+  m_comma(false),
+  m_key(false),
+  m_error(false)
+{
+}
+
+// Check a key, or a value if isKey is false, can go next, noting
+// anything out of place, and return whether a comma goes before it.
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::JsonWriter::next(bool isKey)
+{
+  bool comma = m_comma;
+  if (m_depth == 0)
+    m_error |= isKey || m_comma;  // one value, which is the document
+  else if (m_objects & (1 << (m_depth - 1)))
+  {
+    // an object's members are keys followed by values
+    m_error |= (isKey == m_key);
+    if (!isKey)
+      comma = false;
+  }
+  else
+    m_error |= isKey;
+  m_key = isKey;
+  m_comma = !isKey;
+  return comma;
+}
+
+// Write text, with a comma before it if there should be one, in one
+// piece.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::write(bool comma, const char *text,
+                                        size_t length)
+{
+  if (comma)
+    m_server.write(',');
+  m_server.write((const uint8_t *)text, length);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::open(uint8_t ch, bool object)
+{
+  if (next(false))
+    m_server.write(',');
+  m_server.write(ch);
+  if (m_depth < 16)
+  {
+    if (object)
+      m_objects |= 1 << m_depth;
+    else
+      m_objects &= ~(1 << m_depth);
+    ++m_depth;
+  }
+  else
+    m_error = true;
+  m_comma = false;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::close(uint8_t ch, bool object)
+{
+  if (m_depth == 0 || m_key ||
+      ((m_objects & (1 << (m_depth - 1))) != 0) != object)
+    m_error = true;
+  else
+    --m_depth;
+  m_server.write(ch);
+  m_comma = true;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::beginObject()
+{
+  open('{', true);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::endObject()
+{
+  close('}', true);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::beginArray()
+{
+  open('[', false);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::endArray()
+{
+  close(']', false);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::key(const prog_uchar *name)
+{
+  write(next(true), "\"", 1);
+  m_server.printP(name);
+  m_server.write((const uint8_t *)"\":", 2);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::key(const char *name)
+{
+  write(next(true), "\"", 1);
+  writeString(name);
+  m_server.write((const uint8_t *)"\":", 2);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::value(int number)
+{
+  value((long)number);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::value(unsigned int number)
+{
+  value((unsigned long)number);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::value(long number)
+{
+  fixed(number, 0);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::value(unsigned long number)
+{
+  // three characters a byte is room enough for the digits
+  char text[sizeof(unsigned long) * 3];
+  char *start = webduinoFormatDecimal(text + sizeof(text), number);
+  write(next(false), start, text + sizeof(text) - start);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::fixed(long number, uint8_t places)
+{
+  // the digits, a sign, a point and a leading 0
+  char text[sizeof(unsigned long) * 3 + 3];
+  char *start = text + sizeof(text);
+  unsigned long n = number < 0 ? -(unsigned long)number : number;
+  if (places > 10)
+    places = 10;
+  if (places > 0)
+  {
+    for (uint8_t i = 0; i < places; ++i)
     {
-      *request = ch;
-      ++request;
-      --*length;
+      *--start = '0' + n % 10;
+      n /= 10;
     }
+    *--start = '.';
+  }
+  start = webduinoFormatDecimal(start, n);
+  if (number < 0)
+    *--start = '-';
+  write(next(false), start, text + sizeof(text) - start);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::value(bool b)
+{
+  if (b)
+    write(next(false), "true", 4);
+  else
+    write(next(false), "false", 5);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::null()
+{
+  write(next(false), "null", 4);
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::value(const char *str)
+{
+  if (str == NULL)
+  {
+    null();
+    return;
   }
-  // NUL terminate
-  *request = 0;
+  write(next(false), "\"", 1);
+  writeString(str);
+  m_server.write('"');
 }
 
-void WebServer::processHeaders()
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::valueP(const prog_uchar *str)
 {
-  // look for two things: the Content-Length header and the double-CRLF
-  // that ends the headers.
+  // escaped a piece at a time from a copy in RAM
+  char piece[17];
+  uint8_t length;
 
-  while (1)
+  write(next(false), "\"", 1);
+  do
   {
-    if (expect("Content-Length:"))
+    for (length = 0; length < sizeof(piece) - 1; ++length)
     {
-      readInt(m_contentLength);
-#if WEBDUINO_SERIAL_DEBUGGING > 1
-      Serial.print("\n*** got Content-Length of ");
-      Serial.print(m_contentLength);
-      Serial.print(" ***");
-#endif
+      piece[length] = pgm_read_byte(str++);
+      if (piece[length] == 0)
+        break;
+    }
+    piece[length] = 0;
+    writeString(piece);
+  } while (length == sizeof(piece) - 1);
+  m_server.write('"');
+}
+
+// Write str escaped for a JSON string, the characters that need no
+// escaping in runs as long as they come.
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::JsonWriter::writeString(const char *str)
+{
+  static const char hex[] = "0123456789abcdef";
+  const char *run = str;
+  for (;; ++str)
+  {
+    uint8_t ch = *str;
+    if (ch >= 0x20 && ch != '"' && ch != '\\')
       continue;
+    if (str > run)
+      m_server.write((const uint8_t *)run, str - run);
+    if (ch == 0)
+      return;
+    run = str + 1;
+
+    char escape[6] = { '\\', (char)ch, 0, 0, 0, 0 };
+    uint8_t length = 2;
+    switch (ch)
+    {
+    case '"':
+    case '\\':
+      break;
+    case '\b': escape[1] = 'b'; break;
+    case '\f': escape[1] = 'f'; break;
+    case '\n': escape[1] = 'n'; break;
+    case '\r': escape[1] = 'r'; break;
+    case '\t': escape[1] = 't'; break;
+    default:
+      // other control characters as \u00xx
+      escape[1] = 'u';
+      escape[2] = '0';
+      escape[3] = '0';
+      escape[4] = hex[ch >> 4];
+      escape[5] = hex[ch & 0xf];
+      length = 6;
+      break;
     }
+    m_server.write((const uint8_t *)escape, length);
+  }
+}
 
-    if (expect(CRLF CRLF))
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::JsonWriter::done() const
+{
+  return !m_error && m_depth == 0 && m_comma;
+}
+
+// Return the number of the name in names, a list separated by spaces,
+// that's the same as the len characters at name, or -1 if none is.
+// Both are in program memory.
+static int webduinoFindName(const prog_uchar *names, const prog_uchar *name,
+                            uint16_t len)
+{
+  int which = 0;
+  for (;;)
+  {
+    uint16_t j = 0;
+    while (j < len && pgm_read_byte(names + j) == pgm_read_byte(name + j))
+      ++j;
+    uint8_t ch = pgm_read_byte(names + j);
+    if (j == len && (ch == ' ' || ch == 0))
+      return which;
+
+    // on to the next name
+    while ((ch = pgm_read_byte(names)) != ' ' && ch != 0)
+      ++names;
+    if (ch == 0)
+      return -1;
+    ++names;
+    ++which;
+  }
+}
+
+WEBDUINO_TEMPLATE
+bool WEBDUINO_SERVER::compileTemplate(Template *tmpl, const prog_uchar *text,
+                                      const prog_uchar *names)
+{
+  tmpl->text = text;
+  tmpl->length = 0;
+  tmpl->count = 0;
+
+  uint16_t i = 0;
+  uint8_t ch;
+  while ((ch = pgm_read_byte(text + i)) != 0)
+  {
+    if (ch != '{' || pgm_read_byte(text + i + 1) != '{')
     {
-      m_readingContent = true;
-      return;
+      ++i;
+      continue;
     }
 
-    // no expect checks hit, so just absorb a character and try again
-    if (read() == -1)
+    uint16_t end = i + 2;
+    while ((ch = pgm_read_byte(text + end)) != '}' && ch != 0)
+      ++end;
+    int name = webduinoFindName(names, text + i + 2, end - i - 2);
+    if (ch == 0 || pgm_read_byte(text + end + 1) != '}' || name < 0 ||
+        tmpl->count == WEBDUINO_TEMPLATE_SLOTS)
     {
-      return;
+      tmpl->count = 0;
+      return false;
     }
+
+    typename Template::Slot &slot = tmpl->slots[tmpl->count++];
+    slot.start = i;
+    slot.end = end + 2;
+    slot.name = name;
+    i = slot.end;
+  }
+
+  tmpl->length = i;
+  return true;
+}
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::renderTemplate(const Template *tmpl,
+                                     TemplateCommand *cmd, void *context)
+{
+  uint16_t pos = 0;
+  for (uint8_t i = 0; i < tmpl->count; ++i)
+  {
+    const typename Template::Slot &slot = tmpl->slots[i];
+    writeP(tmpl->text + pos, slot.start - pos);
+    cmd(*this, slot.name, context);
+    pos = slot.end;
+  }
+  writeP(tmpl->text + pos, tmpl->length - pos);
+}
+
+// what outputCheckboxOrRadio() fills its template in with
+struct WebduinoFormField
+{
+  const char *element;
+  const char *name;
+  const char *val;
+  const char *label;
+  bool selected;
+};
+
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::formField(WebServerT &server, uint8_t name,
+                                void *context)
+{
+  P(checked) = "checked ";
+  const WebduinoFormField *field = (const WebduinoFormField *)context;
+  switch (name)
+  {
+  case 0: server.print(field->element); break;
+  case 1: server.print(field->name); break;
+  case 2: server.print(field->val); break;
+  case 3: if (field->selected) server.printP(checked); break;
+  case 4: server.print(field->label); break;
   }
 }
 
-void WebServer::outputCheckboxOrRadio(const char *element, const char *name,
-                                      const char *val, const char *label,
-                                      bool selected)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::outputCheckboxOrRadio(const char *element,
+                                            const char *name,
+                                            const char *val,
+                                            const char *label,
+                                            bool selected)
 {
-  P(cbPart1a) = "<label><input type='";
-  P(cbPart1b) = "' name='";
-  P(cbPart2) = "' value='";
-  P(cbPart3) = "' ";
-  P(cbChecked) = "checked ";
-  P(cbPart4) = "/> ";
-  P(cbPart5) = "</label>";
+  P(formText) =
+    "<label><input type='{{element}}' name='{{name}}' value='{{val}}' "
+    "{{checked}}/> {{label}}</label>";
+  P(formNames) = "element name val checked label";
+  static Template form;
+
+  if (form.text == NULL)
+    compileTemplate(&form, formText, formNames);
 
-  printP(cbPart1a);
-  print(element);
-  printP(cbPart1b);
-  print(name);
-  printP(cbPart2);
-  print(val);
-  printP(cbPart3);
-  if (selected)
-    printP(cbChecked);
-  printP(cbPart4);
-  print(label);
-  printP(cbPart5);
+  WebduinoFormField field = { element, name, val, label, selected };
+  renderTemplate(&form, &formField, &field);
 }
 
-void WebServer::checkBox(const char *name, const char *val,
-                         const char *label, bool selected)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::checkBox(const char *name, const char *val,
+                               const char *label, bool selected)
 {
   outputCheckboxOrRadio("checkbox", name, val, label, selected);
 }
 
-void WebServer::radioButton(const char *name, const char *val,
-                            const char *label, bool selected)
+WEBDUINO_TEMPLATE
+void WEBDUINO_SERVER::radioButton(const char *name, const char *val,
+                                  const char *label, bool selected)
 {
   outputCheckboxOrRadio("radio", name, val, label, selected);
 }